@@ -1,16 +1,62 @@
 {
+  "variables": {
+    "with_bcm2835%": 1,
+    "with_tools%": 0
+  },
   "targets": [
     {
       "target_name": "rc522",
       "sources": [
         "src/rc522.c",
+        "src/rc522_sim.c",
         "src/rfid.c",
+        "src/keycache.c",
+        "src/ndef.c",
+        "src/presence.c",
+        "src/gpio_irq.c",
+        "src/transport_spidev.c",
         "src/accessor.cc"
       ],
-      "libraries": [
-        "-lbcm2835"
+      "conditions": [
+        ["with_bcm2835==1", {
+          "sources": ["src/transport_bcm2835.c"],
+          "defines": ["RC522_WITH_BCM2835"],
+          "libraries": ["-lbcm2835"]
+        }]
       ],
       'cflags_cc': ['-fexceptions'],
     }
+  ],
+  "conditions": [
+    ["with_tools==1", {
+      "targets": [
+        {
+          "target_name": "rc522_bench",
+          "type": "executable",
+          "sources": [
+            "src/rc522.c",
+            "src/rc522_sim.c",
+            "src/rfid.c",
+            "src/keycache.c",
+            "src/ndef.c",
+            "src/rc522_bench.c"
+          ]
+        },
+        {
+          "target_name": "rc522_test",
+          "type": "executable",
+          "include_dirs": ["src"],
+          "sources": [
+            "src/rc522.c",
+            "src/rc522_sim.c",
+            "src/rfid.c",
+            "src/keycache.c",
+            "src/ndef.c",
+            "src/presence.c",
+            "test/rc522_test.c"
+          ]
+        }
+      ]
+    }]
   ]
 }
@@ -1,8 +1,144 @@
-declare const _default: (
-  options: {
-    delay?: number;
-    debug?: boolean;
+type ReaderOptions = {
+  clockDivider?: number;
+  /** hardware chip select of SPI0, 0 for CE0 or 1 for CE1 */
+  chipSelect?: 0 | 1;
+  /** BCM GPIO used as chip select instead of CE0/CE1 */
+  csPin?: number;
+  /** BCM GPIO wired to the RC522 NRSTPD pin, -1 if none, defaults to 25 (P1_22) */
+  resetPin?: number;
+  /** BCM GPIO the RC522 IRQ pin is wired to, commands then complete on its edge instead of being polled */
+  irqPin?: number;
+  /** let the RC522 append and check CRCs instead of computing them on the host */
+  crcOffload?: boolean;
+  /** talk to the reader through the kernel spidev driver, e.g. "/dev/spidev0.0", instead of the bcm2835 library */
+  spidev?: string;
+  simulator?: {
+    tags: {
+      uid: string;
+      type?: "classic1k" | "classic4k" | "ultralight" | "ntag213" | "ntag215" | "ntag216";
+    }[];
+  };
+};
+
+type Options = ReaderOptions & {
+  delay?: number;
+  /** pause the polling backs off to, doubling each poll, once the field was idle for activeWindow ms; defaults to delay, i.e. no back off */
+  idleDelay?: number;
+  /** ms after a tag was seen or a job ran during which readers are polled every delay ms, defaults to 1000 */
+  activeWindow?: number;
+  /** while idle switch the field ("antenna") or the chip ("powerDown") off between polls, defaults to "off" */
+  powerSave?: "off" | "antenna" | "powerDown";
+  debug?: boolean;
+  /** entries of the key cache, 0 disables it, defaults to 256 */
+  keyCacheSize?: number;
+  /** file the key cache is loaded from and saved to, none by default */
+  keyCacheFile?: string;
+  /** events queued for JS at most, defaults to 64 */
+  eventQueueSize?: number;
+  /** when the queue is full hold changes back and report the state once there is room (default), or drop the oldest event */
+  overflow?: "coalesce" | "dropOldest";
+  /** above 1 the callback gets arrays of up to batchSize events, defaults to 1 */
+  batchSize?: number;
+  /** ms a batch may wait to fill up, defaults to 0: whatever is queued when JS drains */
+  batchLatency?: number;
+  /** UIDs in events as hex strings (default) or Buffers */
+  uidFormat?: "hex" | "buffer";
+  /** polls in a row that must see a tag before it is reported, defaults to 1 */
+  presentAfter?: number;
+  /** polls in a row that must miss a tag before it is reported gone, defaults to 1 */
+  absentAfter?: number;
+  /** ms a tag must stay unseen before it is reported gone, defaults to 0 */
+  absentTime?: number;
+  /** one entry per reader, the options above are the defaults for each of them */
+  readers?: ReaderOptions[];
+};
+
+type EventDetails = {
+  /** CLOCK_MONOTONIC ns when the reader got the answer, comparable with process.hrtime.bigint() */
+  timestamp: bigint;
+  /** ns from the WUPA to the answer */
+  cycle: number;
+  /** the tag found, none once it left; in inventory mode one per uids entry. atqa is 0 if the answers collided */
+  tags: { uid: Buffer; atqa: number; sak: number }[];
+  /** ns each tag that left was present, in the order of changes.left */
+  dwell: number[];
+};
+/** a hex string, or a Buffer with uidFormat: "buffer" */
+type Uid = string | Buffer;
+type TagEvent = EventDetails &
+  (
+    | { uid: Uid | null; reader: number }
+    | { uids: Uid[]; reader: number; changes?: { entered: Uid[]; left: Uid[] } }
+  );
+
+declare function _default(
+  options: Options & { inventory?: false; batchSize?: 1 },
+  /** reader is the index into options.readers, 0 with a single reader */
+  callback: (uid: Uid | null, reader: number, details?: EventDetails) => void
+): () => void;
+declare function _default(
+  options: Options & {
+    /** report all tags in the field instead of one, see README */
+    inventory: true;
+    batchSize?: 1;
   },
-  callback: (uid: string | null) => void
-) => () => void;
+  callback: (
+    uids: Uid[],
+    reader: number,
+    changes?: { entered: Uid[]; left: Uid[] },
+    details?: EventDetails
+  ) => void
+): () => void;
+declare function _default(
+  options: Options & { batchSize: number },
+  callback: (events: TagEvent[]) => void
+): () => void;
+type BlockOptions = {
+  /** index into options.readers, default 0 */
+  reader?: number;
+  /** authenticate with key A (default) or B */
+  keyType?: "A" | "B";
+};
+type Key = string | Buffer | { key: string | Buffer; type?: "A" | "B" };
+type Keys = string | Buffer | Key[] | null;
+
+type WriteOptions = BlockOptions & {
+  /** read each written block back in the same authentication */
+  verify?: boolean;
+  /** allow writing sector trailers, i.e. keys and access bits */
+  trailer?: boolean;
+};
+type WriteResult = { written: number; skipped: number };
+
+/**
+ * errors have a code: "NOTAG", "AUTH", "READ", "TYPE", "WRITE", "DENIED", "VERIFY", "RANGE", "NDEF" or "NOREADER",
+ * failed writes also the block that failed and the number of blocks written before
+ */
+declare namespace _default {
+  /** key defaults to ffffffffffff, an array is a dictionary tried in order */
+  function readBlock(uid: string | Buffer, block: number, key?: Keys, options?: BlockOptions): Promise<Buffer>;
+  function readSector(uid: string | Buffer, sector: number, key?: Keys, options?: BlockOptions): Promise<Buffer>;
+  /** sectors holds null or the error code for each sector, failed sectors are zeroed in data */
+  function dumpCard(uid: string | Buffer, key?: Keys, options?: BlockOptions): Promise<{ data: Buffer; sectors: (string | null)[] }>;
+  /** Ultralight/NTAG21x pages, by default all from page on */
+  function readPages(uid: string | Buffer, page?: number, count?: number, options?: { reader?: number }): Promise<Buffer>;
+  /** type, id and payload are views of message, no copies */
+  function readNdef(uid: string | Buffer, options?: { reader?: number }): Promise<{
+    message: Buffer;
+    records: { tnf: number; type: Buffer; id: Buffer; payload: Buffer }[];
+  }>;
+  function writeBlock(uid: string | Buffer, block: number, data: string | Buffer, key?: Keys, options?: WriteOptions): Promise<WriteResult>;
+  /** data holds the data blocks of the sector (without block 0 in sector 0), with options.trailer also the trailer */
+  function writeSector(uid: string | Buffer, sector: number, data: string | Buffer, key?: Keys, options?: WriteOptions): Promise<WriteResult>;
+  /** stops polling and releases the readers, queued reads and writes reject with "NOREADER", pending nextTag() calls with "STOPPED" */
+  function stop(): void;
+  /** stop() and start again with options, or the last ones; callbacks and events() iterators are kept */
+  function restart(options?: Options): void;
+  function keyCacheStats(): { hits: number; misses: number; entries: number };
+  /** the events as objects, buffering up to highWaterMark (default 16) of them; ends with stop() */
+  function events(options?: { highWaterMark?: number }): AsyncIterableIterator<TagEvent>;
+  /** the next event with a tag found or entered, rejects with code "TIMEOUT" after options.timeout ms and "STOPPED" at stop() or restart() */
+  function nextTag(options?: { timeout?: number; reader?: number }): Promise<TagEvent>;
+  function eventStats(): { delivered: number; dropped: number; coalesced: number; queued: number };
+}
 export default _default;
@@ -1,26 +1,343 @@
 const native = require("./build/Release/rc522.node");
 const listeners = new Set();
-let value = null;
+const values = [];
 let isInit = false;
 
-module.exports = exports = function (options, callback) {
-  listeners.add(callback);
-  callback(value);
+let lastOptions = null;
+let batched = false;
+
+// Consumers of event objects: iterators from events() and nextTag() calls
+const iterators = new Set();
+const waiters = new Set();
+let paused = false;
+
+function dispatch(event) {
+  for (const iterator of iterators) iterator.push(event);
+  for (const waiter of waiters) waiter.push(event);
+  updateDemand();
+}
+
+// Rejects the pending nextTag() calls, the loop they wait on is gone
+function rejectWaiters() {
+  const error = new Error("Polling stopped");
+  error.code = "STOPPED";
+  for (const waiter of waiters) waiter.end(error);
+}
+
+// The native queue is only drained while every iterator has room, once it
+// is full the reader thread coalesces changes instead of queueing them
+function updateDemand() {
+  let full = false;
+  for (const iterator of iterators) full = full || iterator.full();
+  if (full !== paused && isInit) native.pauseEvents(full);
+  paused = full;
+}
+
+function start(options) {
+  isInit = true;
+  lastOptions = options;
+  options = Object.assign({}, options);
 
-  if (!isInit) {
-    isInit = true;
+  if (typeof options.delay !== "number") options.delay = 100;
+  if (typeof options.clockDivider !== "number") options.clockDivider = 512;
+  if (typeof options.debug !== "boolean") options.debug = false;
+  if (typeof options.inventory !== "boolean") options.inventory = false;
+  if (typeof options.irqPin !== "number") options.irqPin = -1;
+  if (typeof options.crcOffload !== "boolean") options.crcOffload = false;
+  if (typeof options.spidev !== "string") options.spidev = "";
+  if (typeof options.chipSelect !== "number") options.chipSelect = 0;
+  if (typeof options.csPin !== "number") options.csPin = -1;
+  if (typeof options.resetPin !== "number") options.resetPin = 25;
+  if (typeof options.keyCacheSize !== "number") options.keyCacheSize = 256;
+  if (typeof options.keyCacheFile !== "string") options.keyCacheFile = "";
+  if (typeof options.eventQueueSize !== "number") options.eventQueueSize = 64;
+  if (options.overflow !== "dropOldest") options.overflow = "coalesce";
+  if (typeof options.batchSize !== "number") options.batchSize = 1;
+  if (typeof options.batchLatency !== "number") options.batchLatency = 0;
+  if (options.uidFormat !== "buffer") options.uidFormat = "hex";
+  if (typeof options.presentAfter !== "number") options.presentAfter = 1;
+  if (typeof options.absentAfter !== "number") options.absentAfter = 1;
+  if (typeof options.absentTime !== "number") options.absentTime = 0;
+  if (typeof options.idleDelay !== "number") options.idleDelay = options.delay;
+  if (typeof options.activeWindow !== "number") options.activeWindow = 1000;
+  if (!["antenna", "powerDown"].includes(options.powerSave)) options.powerSave = "off";
 
-    if (typeof options.delay !== "number") options.delay = 100;
-    if (typeof options.clockDivider !== "number") options.clockDivider = 512;
-    if (typeof options.debug !== "boolean") options.debug = false;
+  // Without a readers list the top level options describe the only reader,
+  // with one they are the defaults for each entry
+  const { readers, ...defaults } = options;
+  options.readers = (Array.isArray(readers) ? readers : [{}]).map(
+    (reader) => Object.assign({}, defaults, reader)
+  );
+  values.length = 0;
+  options.readers.forEach(
+    (reader, index) => (values[index] = options.inventory ? [] : null)
+  );
 
-    native(options, function (newValue) {
-      value = newValue;
-      for (const callback of listeners) callback(value);
+  batched = options.batchSize > 1;
+  if (batched) {
+    // One call per batch, for the listeners too
+    native.start(options, function (events) {
+      for (const event of events)
+        values[event.reader] = options.inventory ? event.uids : event.uid;
+      for (const callback of listeners) callback(events);
+      if (iterators.size || waiters.size) events.forEach(dispatch);
+    });
+  } else {
+    // (uid, reader, details) or (uids, reader, changes, details)
+    native.start(options, function (newValue, reader, ...rest) {
+      values[reader] = newValue;
+      for (const callback of listeners) callback(newValue, reader, ...rest);
+      if (!iterators.size && !waiters.size) return;
+      const details = rest.pop();
+      if (options.inventory)
+        dispatch({ uids: newValue, reader, changes: rest[0], ...details });
+      else dispatch({ uid: newValue, reader, ...details });
     });
   }
 
+  // A new queue drains until an iterator is full again
+  paused = false;
+  updateDemand();
+}
+
+module.exports = exports = function (options, callback) {
+  listeners.add(callback);
+
+  if (!isInit) start(options);
+
+  if (batched)
+    callback(
+      values.map((value, reader) =>
+        Array.isArray(value) ? { uids: value, reader } : { uid: value, reader }
+      )
+    );
+  else values.forEach((value, reader) => callback(value, reader));
+
   return function () {
     listeners.delete(callback);
   };
 };
+
+// Stops polling, waiting for the reader thread, and releases the readers so
+// the process can exit; pending reads, writes and nextTag() calls reject.
+// Listeners are kept for a later restart.
+exports.stop = function () {
+  isInit = false;
+  native.stop();
+  rejectWaiters();
+  for (const iterator of iterators) iterator.end();
+};
+
+// Restarts polling with new options, or else the last ones; iterators go on,
+// pending nextTag() calls reject as for stop()
+exports.restart = function (options) {
+  isInit = false;
+  native.stop();
+  rejectWaiters();
+  start(options || lastOptions || {});
+};
+
+// An async iterator over the tag events, { uid, reader, ...details } or in
+// inventory mode { uids, reader, changes, ...details }. Up to highWaterMark
+// events are buffered, beyond that the reader coalesces them. It ends with
+// stop() or when the loop is left.
+exports.events = function (options) {
+  const highWaterMark = (options && options.highWaterMark) || 16;
+  const queue = [];
+  let resolve = null;
+  let done = false;
+
+  const iterator = {
+    push(event) {
+      if (resolve) resolve({ value: event, done: false });
+      else queue.push(event);
+      resolve = null;
+    },
+    full() {
+      return queue.length >= highWaterMark;
+    },
+    end() {
+      done = true;
+      iterators.delete(iterator);
+      if (resolve) resolve({ value: undefined, done: true });
+      resolve = null;
+      updateDemand();
+    },
+  };
+  iterators.add(iterator);
+
+  return {
+    next() {
+      if (queue.length) {
+        const value = queue.shift();
+        updateDemand();
+        return Promise.resolve({ value, done: false });
+      }
+      if (done) return Promise.resolve({ value: undefined, done: true });
+      return new Promise((r) => (resolve = r));
+    },
+    return() {
+      iterator.end();
+      return Promise.resolve({ value: undefined, done: true });
+    },
+    [Symbol.asyncIterator]() {
+      return this;
+    },
+  };
+};
+
+// Resolves with the next event in which a tag was found, or in inventory
+// mode entered the field, optionally on one reader only. Rejects with the
+// code TIMEOUT after options.timeout ms, with STOPPED at stop() or restart().
+exports.nextTag = function (options) {
+  options = options || {};
+  return new Promise(function (resolve, reject) {
+    let timer = null;
+    const waiter = {
+      push(event) {
+        if (options.reader !== undefined && event.reader !== options.reader) return;
+        if (event.changes ? !event.changes.entered.length : !event.uid) return;
+        waiters.delete(waiter);
+        clearTimeout(timer);
+        resolve(event);
+      },
+      end(error) {
+        waiters.delete(waiter);
+        clearTimeout(timer);
+        reject(error);
+      },
+    };
+    waiters.add(waiter);
+    if (options.timeout > 0)
+      timer = setTimeout(function () {
+        const error = new Error("No tag within the timeout");
+        error.code = "TIMEOUT";
+        waiter.end(error);
+      }, options.timeout);
+  });
+};
+
+function toBuffer(value, length, name) {
+  const buffer = Buffer.isBuffer(value) ? value : Buffer.from(value, "hex");
+  if (length ? buffer.length !== length : ![4, 7, 10].includes(buffer.length))
+    throw new RangeError("Invalid " + name);
+  return buffer;
+}
+
+// Packs a key, or a dictionary of keys tried in order, into 7 byte records
+// of key type (0 for A, 1 for B) and key. Entries are a key or { key, type }.
+function toKeys(key, options) {
+  const keys = Array.isArray(key) ? key : [key || "ffffffffffff"];
+  if (keys.length === 0) throw new RangeError("Invalid key");
+  const buffer = Buffer.alloc(keys.length * 7);
+  keys.forEach((entry, index) => {
+    const isObject = entry && !Buffer.isBuffer(entry) && typeof entry === "object";
+    const type = isObject && entry.type ? entry.type : options.keyType;
+    buffer[index * 7] = type === "B" ? 1 : 0;
+    toBuffer(isObject ? entry.key : entry, 6, "key").copy(buffer, index * 7 + 1);
+  });
+  return buffer;
+}
+
+function readBlocks(uid, block, count, key, options) {
+  options = options || {};
+  return native.readBlocks(
+    options.reader || 0,
+    toBuffer(uid, 0, "uid"),
+    block,
+    count,
+    toKeys(key, options)
+  );
+}
+
+// Resolves with the 16 bytes of a MIFARE Classic block
+exports.readBlock = function (uid, block, key, options) {
+  if (!(block >= 0 && block < 256)) throw new RangeError("Invalid block");
+  return readBlocks(uid, block, 1, key, options);
+};
+
+// Resolves with all blocks of a sector, including the trailer, read in one
+// authentication; sectors 32 to 39 of a 4K card have 16 blocks
+exports.readSector = function (uid, sector, key, options) {
+  if (!(sector >= 0 && sector < 40)) throw new RangeError("Invalid sector");
+  if (sector < 32) return readBlocks(uid, sector * 4, 4, key, options);
+  return readBlocks(uid, 128 + (sector - 32) * 16, 16, key, options);
+};
+
+function isTrailer(block) {
+  return block < 128 ? block % 4 === 3 : block % 16 === 15;
+}
+
+function writeBlocks(uid, block, count, data, key, options) {
+  options = options || {};
+  const buffer = toBuffer(data, count * 16, "data");
+  return native.writeBlocks(
+    options.reader || 0,
+    toBuffer(uid, 0, "uid"),
+    block,
+    buffer,
+    toKeys(key, options),
+    options.verify === true
+  );
+}
+
+// Resolves with { written, skipped }: blocks known to hold data already are
+// not written. Block 0 is read only; a sector trailer, which holds the keys
+// and access bits, is only written with options.trailer.
+exports.writeBlock = function (uid, block, data, key, options) {
+  if (!(block > 0 && block < 256)) throw new RangeError("Invalid block");
+  if (isTrailer(block) && !(options && options.trailer))
+    throw new RangeError("Block is a sector trailer");
+  return writeBlocks(uid, block, 1, data, key, options);
+};
+
+// Writes the data blocks of a sector, without block 0 in sector 0, and with
+// options.trailer the trailer too; data holds exactly these blocks
+exports.writeSector = function (uid, sector, data, key, options) {
+  if (!(sector >= 0 && sector < 40)) throw new RangeError("Invalid sector");
+  let block = sector < 32 ? sector * 4 : 128 + (sector - 32) * 16;
+  let count = (sector < 32 ? 4 : 16) - (options && options.trailer ? 0 : 1);
+  if (sector === 0) block++, count--;
+  return writeBlocks(uid, block, count, data, key, options);
+};
+
+// Resolves with count pages of an Ultralight or NTAG21x from page on, by
+// default all of its memory
+exports.readPages = function (uid, page, count, options) {
+  options = options || {};
+  page = page || 0;
+  count = count || 0;
+  if (!(page >= 0 && page < 256)) throw new RangeError("Invalid page");
+  if (!(count >= 0 && page + count <= 256)) throw new RangeError("Invalid count");
+  return native.readPages(options.reader || 0, toBuffer(uid, 0, "uid"), page, count);
+};
+
+// Resolves with { message, records } for the NDEF message of an Ultralight
+// or NTAG21x; every record has its tnf and type, id and payload Buffers,
+// views of message
+exports.readNdef = function (uid, options) {
+  options = options || {};
+  return native.readNdef(options.reader || 0, toBuffer(uid, 0, "uid"));
+};
+
+// Resolves with { data, sectors }: the whole memory of a MIFARE Classic
+// Mini/1K/4K, each sector read in one authentication, and per sector null or
+// the code of the error that left it zeroed in data
+exports.dumpCard = function (uid, key, options) {
+  options = options || {};
+  return native.dumpCard(
+    options.reader || 0,
+    toBuffer(uid, 0, "uid"),
+    toKeys(key, options)
+  );
+};
+
+// { hits, misses, entries } of the key cache
+exports.keyCacheStats = function () {
+  return native.keyCacheStats();
+};
+
+// { delivered, dropped, coalesced, queued } of the queue of tag events
+exports.eventStats = function () {
+  return native.eventStats();
+};
@@ -2,173 +2,1436 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <list>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
 #include <assert.h>
+#include <time.h>
 #include "rfid.h"
 #include "rc522.h"
-#include "bcm2835.h"
+#include "rc522_sim.h"
+#include "presence.h"
 
-uint8_t initRfidReader(int64_t clockDivider)
+struct UidEvent
 {
-	if (!bcm2835_init())
+	uint32_t reader;
+	// Inventory mode: all tags in the field and the ones that entered or left
+	bool inventory;
+	uint8_t enteredCount;
+	uint8_t leftCount;
+	rfid_uid entered[INVENTORY_MAX_TAGS];
+	rfid_uid left[INVENTORY_MAX_TAGS];
+	// ns each tag that left, also in single tag mode, was present
+	uint64_t dwell[INVENTORY_MAX_TAGS];
+	// CLOCK_MONOTONIC ns when the cycle got its answer and the cycle's ns
+	// since its WUPA
+	uint64_t timestamp;
+	uint32_t cycle;
+	// UID, ATQA and SAK of the tags in the field: none or the one found, in
+	// inventory mode all of them
+	uint8_t count;
+	rfid_uid tags[INVENTORY_MAX_TAGS];
+};
+
+struct Reader
+{
+	int64_t clockDivider;
+	int64_t chipSelect;
+	int64_t csPin;
+	int64_t resetPin;
+	int64_t irqPin;
+	bool crcOffload;
+	char spidev[64];
+	rc522_sim *sim;
+	rc522_transport transport;
+	rc522_dev dev;
+	bool open;
+
+	// Scheduler state
+	bool pending;
+	uint32_t polls;
+	uint64_t cycleStart;
+	// Antenna or chip off until the next poll, see powerSave
+	bool asleep;
+	// A job HALTed a tag since the last poll, see runJobs
+	bool halted;
+	// Debounced tags, the reported flag marks the ones last reported
+	presence tracker;
+	// The event being built
+	UidEvent event;
+	// Blocks of the tag last accessed, dropped once the tag is known to have
+	// left: an empty field, an inventory without it, or a job that lost it
+	rfid_image image;
+};
+
+#define JOB_READ 0
+#define JOB_DUMP 1
+#define JOB_WRITE 2
+#define JOB_PAGES 3
+#define JOB_NDEF 4
+
+// A tag operation requested from JS, run by the reader thread between polls
+struct Job
+{
+	uint8_t type;
+	uint32_t reader;
+	uint8_t uid[10];
+	uint8_t uidLength;
+	uint8_t block;
+	// Blocks, or pages of JOB_PAGES, up to PAGES_MAX
+	uint16_t count;
+	// Keys to try after the cached one
+	rfid_key *keys;
+	uint16_t keyCount;
+	uint8_t status;
+	// Result, handed over to the JS Buffer without a copy
+	uint8_t *data;
+	size_t length;
+	// JOB_WRITE: read back each block, blocks written and the one that failed
+	bool verify;
+	uint8_t written;
+	uint8_t failed;
+	// JOB_DUMP: BLOCK_* status of each sector
+	uint8_t sectors;
+	uint8_t sectorStatus[CLASSIC_MAX_SECTORS];
+	// JOB_NDEF: the message in data and its records
+	uint16_t messageStart;
+	uint16_t messageLength;
+	ndef_record *records;
+	uint8_t recordCount;
+	napi_deferred deferred;
+};
+
+// BLOCK_* codes from rfid.h and the ones only the queue produces
+#define BLOCK_NOREADER 16
+
+// Error code and message a job is rejected with, by BLOCK_* status
+struct BlockError
+{
+	uint8_t status;
+	const char *code;
+	const char *message;
+} blockErrors[] = {
+	{BLOCK_NOTAG, "NOTAG", "No tag with this UID in the field"},
+	{BLOCK_AUTH, "AUTH", "Authentication failed"},
+	{BLOCK_READ, "READ", "Read failed"},
+	{BLOCK_TYPE, "TYPE", "Not supported by this tag type"},
+	{BLOCK_WRITE, "WRITE", "Write not acknowledged"},
+	{BLOCK_DENIED, "DENIED", "Write refused by the tag"},
+	{BLOCK_VERIFY, "VERIFY", "Block read back differs"},
+	{BLOCK_RANGE, "RANGE", "Beyond the end of the tag's memory"},
+	{BLOCK_NDEF, "NDEF", "No valid NDEF message"},
+	{BLOCK_NOREADER, "NOREADER", "Reader not running"},
+};
+
+const BlockError *blockError(uint8_t status)
+{
+	for (size_t i = 0; i < sizeof(blockErrors) / sizeof(blockErrors[0]); i++)
 	{
-		return 1;
+		if (blockErrors[i].status == status)
+			return &blockErrors[i];
 	}
+	return NULL;
+}
 
-	// Reset device
-	bcm2835_gpio_fsel(RPI_GPIO_P1_22, BCM2835_GPIO_FSEL_OUTP);
-	usleep(50000);
-	bcm2835_gpio_set(RPI_GPIO_P1_22);
+struct EventRing;
 
-	bcm2835_spi_begin();
-	bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST); // The default
-	bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);				 // The default
-	bcm2835_spi_setClockDivider(clockDivider);				 // The default
-	bcm2835_spi_chipSelect(BCM2835_SPI_CS0);				 // The default
-	bcm2835_spi_setChipSelectPolarity(BCM2835_SPI_CS0, LOW); // the default
-	return 0;
-}
+#define POWER_SAVE_OFF 0
+#define POWER_SAVE_ANTENNA 1
+#define POWER_SAVE_POWER_DOWN 2
 
 struct Data
 {
 	int64_t delay;
-	int64_t clockDivider;
+	// Adaptive polling: once no tag was seen and no job ran for activeWindow
+	// ms the pause doubles each poll up to idleDelay, and the readers save
+	// power while they pause. Used by the reader thread only.
+	int64_t idleDelay;
+	int64_t activeWindow;
+	uint8_t powerSave;
+	int64_t interval;
+	uint64_t lastActivity;
 	bool debug;
-	napi_async_work work;
+	bool inventory;
+	Reader *readers;
+	uint32_t readerCount;
+	std::thread thread;
 	napi_threadsafe_function callback;
+	// Owned by callback, freed once its last call ran
+	EventRing *events;
+	// Events are only signalled to JS once batchSize of them are queued or
+	// the oldest waited batchLatency ms; used by the reader thread only
+	int64_t batchLatency;
+	bool eventsPending;
+	std::chrono::steady_clock::time_point pendingSince;
+
+	// Jobs queued by JS and the stop request, guarded by mutex; wakeup
+	// interrupts the poll delay
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	std::list<Job *> jobs;
+	bool stopping;
+	napi_threadsafe_function jobCallback;
+
+	// Used by the reader thread only, the counters are copied under mutex
+	keycache cache;
+	char keyCacheFile[256];
+	uint64_t cacheHits;
+	uint64_t cacheMisses;
+	uint32_t cacheEntries;
 };
 
+// The running instance, there is only one per process
+static Data *instance = NULL;
+
+#define OVERFLOW_COALESCE 0
+#define OVERFLOW_DROP_OLDEST 1
+
+// Events from the reader thread to the JS thread in preallocated slots, one
+// producer and one consumer. head and tail count events modulo wrap, a
+// multiple of capacity, a slot is their value modulo capacity. A full ring
+// either holds the change back, the reader then reports the state it has
+// when there is room again, or drops the oldest event. Then the producer
+// moves tail on, unless the consumer is copying that event's slot, so no
+// slot is ever read and written at the same time.
+struct EventRing
+{
+	UidEvent *slots;
+	uint32_t capacity;
+	uint32_t wrap;
+	uint8_t overflow;
+	// Events per call of the JS callback, 1 calls it with the arguments of
+	// one event instead of an array
+	uint32_t batchSize;
+	// UIDs are passed as Buffers instead of hex strings
+	bool uidBuffers;
+	std::atomic<uint32_t> head;
+	// Twice the index of the oldest event, plus 1 while the consumer copies
+	// its slot
+	std::atomic<uint32_t> tail;
+	// Set while a call of the threadsafe function is queued to drain the ring,
+	// or while JS paused draining, so the producer doesn't queue calls then
+	std::atomic<bool> signalled;
+	std::atomic<bool> paused;
+	std::atomic<uint64_t> delivered;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> coalesced;
+};
+
+EventRing *createEventRing(uint32_t capacity, uint8_t overflow, uint32_t batchSize, bool uidBuffers)
+{
+	EventRing *ring = new EventRing;
+	ring->capacity = capacity > 0 ? capacity : 1;
+	ring->wrap = 0x40000000 / ring->capacity * ring->capacity;
+	ring->slots = new UidEvent[ring->capacity];
+	ring->overflow = overflow;
+	ring->batchSize = batchSize > 0 ? batchSize : 1;
+	ring->uidBuffers = uidBuffers;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->signalled = false;
+	ring->paused = false;
+	ring->delivered = 0;
+	ring->dropped = 0;
+	ring->coalesced = 0;
+	return ring;
+}
+
+void freeEventRing(napi_env env, void *data, void *hint)
+{
+	EventRing *ring = (EventRing *)data;
+	delete[] ring->slots;
+	delete ring;
+}
+
+uint32_t ringNext(EventRing *ring, uint32_t index)
+{
+	return index + 1 < ring->wrap ? index + 1 : 0;
+}
+
+// Events queued, including one the consumer is copying
+uint32_t ringCount(EventRing *ring, uint32_t head, uint32_t tail)
+{
+	return head >= tail / 2 ? head - tail / 2 : head + ring->wrap - tail / 2;
+}
+
+// Reader thread: false if the event was held back by a full ring
+bool pushEvent(EventRing *ring, const UidEvent *event)
+{
+	uint32_t head = ring->head.load(std::memory_order_relaxed);
+	uint32_t tail = ring->tail.load(std::memory_order_acquire);
+
+	while (ringCount(ring, head, tail) >= ring->capacity)
+	{
+		// The oldest event can't be dropped while the consumer copies it,
+		// there is room once it's done
+		if (ring->overflow == OVERFLOW_COALESCE || (tail & 1))
+		{
+			ring->coalesced++;
+			return false;
+		}
+		// Fails if the consumer took the oldest event or started copying it
+		// meanwhile, tail is reloaded then
+		if (ring->tail.compare_exchange_weak(tail, ringNext(ring, tail / 2) * 2, std::memory_order_acq_rel))
+		{
+			ring->dropped++;
+			break;
+		}
+	}
+	ring->slots[head % ring->capacity] = *event;
+	ring->head.store(ringNext(ring, head), std::memory_order_release);
+	return true;
+}
+
+// JS thread
+bool popEvent(EventRing *ring, UidEvent *event)
+{
+	uint32_t tail = ring->tail.load(std::memory_order_acquire);
+	for (;;)
+	{
+		if (tail / 2 == ring->head.load(std::memory_order_acquire))
+			return false;
+		// Claims the slot, fails if the producer dropped the event meanwhile
+		if (ring->tail.compare_exchange_weak(tail, tail | 1, std::memory_order_acq_rel))
+			break;
+	}
+	*event = ring->slots[tail / 2 % ring->capacity];
+	// The producer leaves tail alone while it's odd
+	ring->tail.store(ringNext(ring, tail / 2) * 2, std::memory_order_release);
+	return true;
+}
+
+uint8_t initRfidReader(Reader *reader)
+{
+	uint8_t irqFailed = 0;
+
+	if (reader->sim != NULL)
+	{
+		rc522_sim_transport(reader->sim, &reader->transport);
+	}
+	else if (reader->spidev[0] != 0)
+	{
+		if (transport_spidev_open(&reader->transport, reader->spidev, 250000000 / reader->clockDivider) != 0)
+		{
+			return 1;
+		}
+		if (reader->irqPin >= 0)
+		{
+			irqFailed = transport_spidev_irq(&reader->transport, reader->irqPin);
+		}
+	}
+	else
+	{
+#ifdef RC522_WITH_BCM2835
+		if (transport_bcm2835_open(&reader->transport, reader->clockDivider, reader->chipSelect, reader->csPin, reader->resetPin) != 0)
+		{
+			return 1;
+		}
+		if (reader->irqPin >= 0)
+		{
+			irqFailed = transport_bcm2835_irq(&reader->transport, reader->irqPin);
+		}
+#else
+		return 1;
+#endif
+	}
+
+	if (irqFailed)
+	{
+		printf("Failed to open IRQ pin %d, polling instead\n", (int)reader->irqPin);
+	}
+
+	memset(&reader->dev, 0, sizeof(reader->dev));
+	reader->dev.transport = &reader->transport;
+	reader->dev.irq = reader->irqPin >= 0 && reader->transport.wait_irq != NULL;
+	reader->dev.crcOffload = reader->crcOffload;
+	reader->open = true;
+	Rc522Select(&reader->dev);
+	return 0;
+}
+
+void closeRfidReader(Reader *reader)
+{
+	if (!reader->open || reader->sim != NULL)
+	{
+		return;
+	}
+	reader->open = false;
+	if (reader->spidev[0] != 0)
+	{
+		transport_spidev_close(&reader->transport);
+		return;
+	}
+#ifdef RC522_WITH_BCM2835
+	transport_bcm2835_close(&reader->transport);
+#endif
+}
+
+uint8_t parseHex(napi_env env, napi_value value, uint8_t *out, size_t maxLen)
+{
+	char hex[2 * 10 + 1];
+	size_t length, i;
+	unsigned int byte;
+
+	assert(napi_get_value_string_utf8(env, value, hex, sizeof(hex), &length) == napi_ok);
+	if (length % 2 != 0 || length / 2 > maxLen)
+	{
+		return 0;
+	}
+	for (i = 0; i < length / 2; i++)
+	{
+		if (sscanf(hex + 2 * i, "%2x", &byte) != 1)
+		{
+			return 0;
+		}
+		out[i] = byte;
+	}
+	return length / 2;
+}
+
+// options.simulator = { tags: [{ uid: "04a2b3c4", type: "classic1k" }, ...] }
+rc522_sim *createSimulator(napi_env env, napi_value options)
+{
+	static const char *typeNames[] = {"classic1k", "classic4k", "ultralight", "ntag213", "ntag215", "ntag216"};
+	napi_value tags, tag, uid, type;
+	uint32_t count, i;
+	uint8_t uidBytes[10], uidLength, typeIndex;
+	char typeName[16];
+	size_t length;
+	bool hasType;
+
+	rc522_sim *sim = new rc522_sim;
+	rc522_sim_init(sim);
+
+	assert(napi_get_named_property(env, options, "tags", &tags) == napi_ok);
+	if (napi_get_array_length(env, tags, &count) != napi_ok)
+	{
+		count = 0;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		assert(napi_get_element(env, tags, i, &tag) == napi_ok);
+		assert(napi_get_named_property(env, tag, "uid", &uid) == napi_ok);
+		uidLength = parseHex(env, uid, uidBytes, sizeof(uidBytes));
+
+		typeIndex = SIM_TAG_CLASSIC_1K;
+		assert(napi_has_named_property(env, tag, "type", &hasType) == napi_ok);
+		if (hasType)
+		{
+			assert(napi_get_named_property(env, tag, "type", &type) == napi_ok);
+			assert(napi_get_value_string_utf8(env, type, typeName, sizeof(typeName), &length) == napi_ok);
+			for (uint8_t t = 0; t < sizeof(typeNames) / sizeof(typeNames[0]); t++)
+			{
+				if (strcmp(typeName, typeNames[t]) == 0)
+					typeIndex = t;
+			}
+		}
+
+		if (rc522_sim_add_tag(sim, typeIndex, uidBytes, uidLength) == NULL)
+		{
+			printf("Ignoring simulated tag %u\n", i);
+		}
+	}
+
+	return sim;
+}
+
+// Hex of a UID by table lookup, out holds 2 * 10 + 1 chars
+void formatUid(char *out, const rfid_uid *uid)
+{
+	static const char digits[] = "0123456789abcdef";
+	for (uint8_t i = 0; i < uid->len; i++)
+	{
+		*out++ = digits[uid->sn[i] >> 4];
+		*out++ = digits[uid->sn[i] & 0x0f];
+	}
+	*out = 0;
+}
+
+// A UID as reported to JS, a Buffer or a hex string
+napi_value createUid(napi_env env, const rfid_uid *uid, bool buffers)
+{
+	napi_value value;
+	char hex[2 * 10 + 1];
+	void *data;
+
+	if (buffers)
+	{
+		assert(napi_create_buffer_copy(env, uid->len, uid->sn, &data, &value) == napi_ok);
+		return value;
+	}
+	formatUid(hex, uid);
+	assert(napi_create_string_latin1(env, hex, 2 * uid->len, &value) == napi_ok);
+	return value;
+}
+
+napi_value createUidArray(napi_env env, const rfid_uid *uids, uint8_t count, bool buffers)
+{
+	napi_value array;
+	assert(napi_create_array_with_length(env, count, &array) == napi_ok);
+	for (uint8_t i = 0; i < count; i++)
+		assert(napi_set_element(env, array, i, createUid(env, &uids[i], buffers)) == napi_ok);
+	return array;
+}
+
+// Sets timestamp, cycle, tags, [{ uid, atqa, sak }], and dwell of an event
+// on object
+void setEventDetails(napi_env env, napi_value object, const UidEvent *event)
+{
+	napi_value tags, tag, value;
+
+	assert(napi_create_bigint_uint64(env, event->timestamp, &value) == napi_ok);
+	assert(napi_set_named_property(env, object, "timestamp", value) == napi_ok);
+	assert(napi_create_uint32(env, event->cycle, &value) == napi_ok);
+	assert(napi_set_named_property(env, object, "cycle", value) == napi_ok);
+	assert(napi_create_array_with_length(env, event->count, &tags) == napi_ok);
+	for (uint8_t i = 0; i < event->count; i++)
+	{
+		assert(napi_create_object(env, &tag) == napi_ok);
+		assert(napi_set_named_property(env, tag, "uid", createUid(env, &event->tags[i], true)) == napi_ok);
+		// Sent LSB first, rfid_uid has the first byte in the high byte
+		assert(napi_create_uint32(env, (event->tags[i].atqa >> 8) | (event->tags[i].atqa & 0xff) << 8, &value) == napi_ok);
+		assert(napi_set_named_property(env, tag, "atqa", value) == napi_ok);
+		assert(napi_create_uint32(env, event->tags[i].sak, &value) == napi_ok);
+		assert(napi_set_named_property(env, tag, "sak", value) == napi_ok);
+		assert(napi_set_element(env, tags, i, tag) == napi_ok);
+	}
+	assert(napi_set_named_property(env, object, "tags", tags) == napi_ok);
+	assert(napi_create_array_with_length(env, event->leftCount, &tags) == napi_ok);
+	for (uint8_t i = 0; i < event->leftCount; i++)
+	{
+		assert(napi_create_int64(env, event->dwell[i], &value) == napi_ok);
+		assert(napi_set_element(env, tags, i, value) == napi_ok);
+	}
+	assert(napi_set_named_property(env, object, "dwell", tags) == napi_ok);
+}
+
+// The callback arguments of an event: the uid, or the uids in inventory
+// mode, the reader, the changes in inventory mode and the details. Returns
+// their number.
+size_t createEventArgs(napi_env env, const UidEvent *event, bool buffers, napi_value *result)
+{
+	size_t argc = 2;
+	if (event->inventory)
+	{
+		result[0] = createUidArray(env, event->tags, event->count, buffers);
+		assert(napi_create_object(env, &result[2]) == napi_ok);
+		assert(napi_set_named_property(env, result[2], "entered", createUidArray(env, event->entered, event->enteredCount, buffers)) == napi_ok);
+		assert(napi_set_named_property(env, result[2], "left", createUidArray(env, event->left, event->leftCount, buffers)) == napi_ok);
+		argc = 3;
+	}
+	else if (event->count == 0)
+	{
+		assert(napi_get_null(env, &result[0]) == napi_ok);
+	}
+	else
+	{
+		result[0] = createUid(env, &event->tags[0], buffers);
+	}
+	assert(napi_create_uint32(env, event->reader, &result[1]) == napi_ok);
+	assert(napi_create_object(env, &result[argc]) == napi_ok);
+	setEventDetails(env, result[argc], event);
+	return argc + 1;
+}
+
+// A batch entry, { uid, reader } or { uids, reader, changes }, with the
+// details
+napi_value createEventObject(napi_env env, const UidEvent *event, bool buffers)
+{
+	napi_value object, value;
+	assert(napi_create_object(env, &object) == napi_ok);
+	if (event->inventory)
+	{
+		assert(napi_set_named_property(env, object, "uids", createUidArray(env, event->tags, event->count, buffers)) == napi_ok);
+		assert(napi_create_object(env, &value) == napi_ok);
+		assert(napi_set_named_property(env, value, "entered", createUidArray(env, event->entered, event->enteredCount, buffers)) == napi_ok);
+		assert(napi_set_named_property(env, value, "left", createUidArray(env, event->left, event->leftCount, buffers)) == napi_ok);
+		assert(napi_set_named_property(env, object, "changes", value) == napi_ok);
+	}
+	else
+	{
+		if (event->count > 0)
+			value = createUid(env, &event->tags[0], buffers);
+		else
+			assert(napi_get_null(env, &value) == napi_ok);
+		assert(napi_set_named_property(env, object, "uid", value) == napi_ok);
+	}
+	assert(napi_create_uint32(env, event->reader, &value) == napi_ok);
+	assert(napi_set_named_property(env, object, "reader", value) == napi_ok);
+	setEventDetails(env, object, event);
+	return object;
+}
+
+// Drains the event ring, context is the ring. Events are passed one per
+// call, or in arrays of up to batchSize.
 void jsCallbackProcessor(napi_env env, napi_value js_cb,
 						 void *context, void *data)
 {
-	if (env != NULL)
+	EventRing *ring = (EventRing *)context;
+	napi_value args[4], batch, undefined;
+	UidEvent event;
+	uint32_t count;
+	size_t argc;
+
+	// Without demand from JS the events stay in the ring until pauseEvents
+	// resumes, a full ring then holds changes back
+	if (ring->paused && env != NULL)
+		return;
+
+	// Cleared first, an event pushed while draining queues another call
+	ring->signalled = false;
+	if (env == NULL)
 	{
-		char *uid = (char *)data;
-		napi_value result, undefined;
-		if (uid == NULL)
+		while (popEvent(ring, &event))
+			ring->delivered++;
+		return;
+	}
+
+	assert(napi_get_undefined(env, &undefined) == napi_ok);
+	// The callback may pause, e.g. when an iterator filled up
+	if (ring->batchSize == 1)
+	{
+		while (!ring->paused && popEvent(ring, &event))
 		{
-			assert(napi_get_null(env, &result) == napi_ok);
+			ring->delivered++;
+			argc = createEventArgs(env, &event, ring->uidBuffers, args);
+			assert(napi_call_function(env, undefined, js_cb, argc, args, NULL) == napi_ok);
 		}
+		return;
+	}
+
+	do
+	{
+		assert(napi_create_array(env, &batch) == napi_ok);
+		for (count = 0; count < ring->batchSize && popEvent(ring, &event); count++)
+			assert(napi_set_element(env, batch, count, createEventObject(env, &event, ring->uidBuffers)) == napi_ok);
+		if (count == 0)
+			break;
+		ring->delivered += count;
+		assert(napi_call_function(env, undefined, js_cb, 1, &batch, NULL) == napi_ok);
+	} while (count == ring->batchSize && !ring->paused);
+}
+
+// Reader thread: queue a call of the threadsafe function to drain the ring
+// unless one is queued already
+void signalEvents(Data *data)
+{
+	data->eventsPending = false;
+	if (!data->events->signalled.exchange(true))
+		assert(napi_call_threadsafe_function(data->callback, NULL, napi_tsfn_nonblocking) == napi_ok);
+}
+
+// Reader thread: hand an event to JS, false if the ring held it back
+bool emitEvent(Data *data, const UidEvent *event)
+{
+	EventRing *ring = data->events;
+
+	if (!pushEvent(ring, event))
+		return false;
+	if (data->batchLatency == 0 || ringCount(ring, ring->head, ring->tail) >= std::min(ring->batchSize, ring->capacity))
+	{
+		signalEvents(data);
+	}
+	else if (!data->eventsPending)
+	{
+		data->eventsPending = true;
+		data->pendingSince = std::chrono::steady_clock::now();
+	}
+	return true;
+}
+
+// Reader thread: signal events that waited batchLatency, returns how long
+// the next may wait at most
+std::chrono::milliseconds flushEvents(Data *data, int64_t interval)
+{
+	std::chrono::milliseconds wait(interval);
+	if (!data->eventsPending)
+		return wait;
+
+	auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - data->pendingSince);
+	if (waited.count() >= data->batchLatency)
+	{
+		signalEvents(data);
+		return wait;
+	}
+	return std::min(wait, std::chrono::milliseconds(data->batchLatency) - waited);
+}
+
+uint64_t monotonicNs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Let time pass for all readers, simulated ones only advance their own clock
+void sleepReaders(Data *data, uint32_t us)
+{
+	bool hardware = false;
+	for (uint32_t i = 0; i < data->readerCount; i++)
+	{
+		Reader *reader = &data->readers[i];
+		if (reader->sim != NULL)
+			reader->transport.delay_us(reader->transport.ctx, us);
+		else
+			hardware = true;
+	}
+	if (hardware)
+		usleep(us);
+}
+
+// The pause after this cycle, active if a tag is around or a job ran;
+// idle is set once the active window is over
+int64_t nextInterval(Data *data, bool active, bool *idle)
+{
+	uint64_t now = monotonicNs();
+
+	if (active)
+		data->lastActivity = now;
+	*idle = now - data->lastActivity >= (uint64_t)data->activeWindow * 1000000;
+	if (!*idle)
+		data->interval = data->delay;
+	else
+		data->interval = std::min(std::max(data->interval * 2, (int64_t)1), std::max(data->idleDelay, data->delay));
+	return data->interval;
+}
+
+// Switch the field, or the whole chip, off until the next poll
+void powerSaveReaders(Data *data)
+{
+	for (uint32_t i = 0; i < data->readerCount; i++)
+	{
+		Reader *reader = &data->readers[i];
+		if (!reader->open)
+			continue;
+		Rc522Select(&reader->dev);
+		if (data->powerSave == POWER_SAVE_POWER_DOWN)
+			PcdPowerDown();
 		else
+			PcdAntennaOff();
+		reader->asleep = true;
+	}
+}
+
+// Power the readers up again, the tags together get PCD_FIELD_ON_US
+void wakeReaders(Data *data)
+{
+	bool woken = false;
+	for (uint32_t i = 0; i < data->readerCount; i++)
+	{
+		Reader *reader = &data->readers[i];
+		if (!reader->asleep)
+			continue;
+		Rc522Select(&reader->dev);
+		if (data->powerSave == POWER_SAVE_POWER_DOWN)
+			PcdPowerUp();
+		PcdAntennaOn();
+		reader->asleep = false;
+		woken = true;
+	}
+	if (woken)
+		sleepReaders(data, PCD_FIELD_ON_US);
+}
+
+// Index of the tag last reported in single tag mode, or -1
+int reportedTag(presence *p)
+{
+	for (uint8_t i = 0; i < p->count; i++)
+	{
+		if (p->tags[i].reported)
+			return i;
+	}
+	return -1;
+}
+
+// Select the tag that answered the reader's WUPA and report a changed uid
+void finishReader(Data *data, uint32_t index, tag_stat statusRfidReader, uint16_t atqa)
+{
+	Reader *reader = &data->readers[index];
+	presence *p = &reader->tracker;
+	rfid_uid tag;
+	int selectResult, current, next;
+	char hex[2 * 10 + 1];
+	uint64_t now = monotonicNs();
+
+	if (statusRfidReader == TAG_NOTAG)
+	{
+		if (data->debug)
+			printf("No tag found on reader %u\n", index);
+
+		presence_update(p, NULL, 0, now);
+		// Only an empty field tells the tag of the image is gone, with
+		// several tags the poll selects just one of them
+		image_clear(&reader->image);
+	}
+	else if (statusRfidReader != TAG_OK && statusRfidReader != TAG_COLLISION)
+	{
+		if (data->debug)
+			printf("Unexpected status on reader %u: %d\n", index, statusRfidReader);
+	}
+	else if ((selectResult = select_tag_sn(tag.sn, &tag.len)) != TAG_OK)
+	{
+		if (data->debug)
+			printf("Failed to select tag on reader %u: %d\n", index, selectResult);
+	}
+	else
+	{
+		tag.atqa = statusRfidReader == TAG_OK ? atqa : 0;
+		tag.sak = PcdSak();
+		presence_update(p, &tag, 1, now);
+
+		if (data->debug)
 		{
-			assert(napi_create_string_utf8(env, uid, NAPI_AUTO_LENGTH, &result) == napi_ok);
-			delete uid;
+			formatUid(hex, &tag);
+			printf("Tag on reader %u: %s\n", index, hex);
 		}
 
-		assert(napi_get_undefined(env, &undefined) == napi_ok);
-		assert(napi_call_function(env, undefined, js_cb, 1, &result, NULL) == napi_ok);
+		// Halt the selected tag so the next WUPA finds it in a defined state
+		PcdHalt();
 	}
+
+	// The tag reported stays until it is gone, then the first other present
+	// one, if any, replaces it
+	current = reportedTag(p);
+	if (current >= 0 && p->tags[current].state == PRESENCE_PRESENT)
+		return;
+	for (next = 0; next < p->count; next++)
+	{
+		if (p->tags[next].state == PRESENCE_PRESENT)
+			break;
+	}
+	if (next == p->count)
+		next = -1;
+	if (current < 0 && next < 0)
+		return;
+
+	UidEvent *event = &reader->event;
+	event->reader = index;
+	event->inventory = false;
+	event->timestamp = now;
+	event->cycle = now - reader->cycleStart;
+	event->count = 0;
+	event->leftCount = 0;
+	if (next >= 0)
+		event->tags[event->count++] = p->tags[next].uid;
+	if (current >= 0)
+	{
+		event->left[0] = p->tags[current].uid;
+		event->dwell[0] = p->tags[current].lastSeen - p->tags[current].firstSeen;
+		event->leftCount = 1;
+	}
+
+	// Held back, the next cycle compares against the last reported state
+	// again
+	if (!emitEvent(data, event))
+		return;
+	if (next >= 0)
+		p->tags[next].reported = 1;
+	if (current >= 0)
+		presence_remove(p, current);
 }
 
-void execute(napi_env env, void *dataIn)
+// Enumerate every tag that answers the reader's WUPA and report the set if
+// a tag entered or left the field
+void inventoryReader(Data *data, uint32_t index, tag_stat statusRfidReader)
 {
-	Data *data = (Data *)dataIn;
+	Reader *reader = &data->readers[index];
+	presence *p = &reader->tracker;
+	rfid_uid uids[INVENTORY_MAX_TAGS];
+	uint8_t count, i;
+	bool seen = false;
+	uint64_t now;
 
-	char statusRfidReader;
-	uint16_t CType = 0;
-	uint8_t serialNumber[10];
-	uint8_t serialNumberLength = 0;
-	bool foundTag = false;
-	bool lastFoundTag = false;
-	char uid[23] = {0};
-	char lastUid[23] = {0};
-	char *p;
-	int loopCounter;
+	count = inventory_tags(statusRfidReader, uids, INVENTORY_MAX_TAGS);
+	for (i = 0; i < count; i++)
+		seen = seen || image_holds(&reader->image, uids[i].sn, uids[i].len);
+	// A full inventory may have left the tag out
+	if (!seen && count < INVENTORY_MAX_TAGS)
+		image_clear(&reader->image);
+	now = monotonicNs();
+	presence_update(p, uids, count, now);
+
+	UidEvent *event = &reader->event;
+	event->reader = index;
+	event->inventory = true;
+	event->timestamp = now;
+	event->cycle = now - reader->cycleStart;
+	event->count = 0;
+	event->enteredCount = 0;
+	event->leftCount = 0;
+	for (i = 0; i < p->count; i++)
+	{
+		presence_tag *tag = &p->tags[i];
+		if (tag->state == PRESENCE_PRESENT)
+		{
+			event->tags[event->count++] = tag->uid;
+			if (!tag->reported)
+				event->entered[event->enteredCount++] = tag->uid;
+		}
+		else if (tag->state == PRESENCE_GONE)
+		{
+			event->left[event->leftCount] = tag->uid;
+			event->dwell[event->leftCount++] = tag->lastSeen - tag->firstSeen;
+		}
+	}
 
-	assert(napi_acquire_threadsafe_function(data->callback) == napi_ok);
+	if (data->debug)
+		printf("Inventory on reader %u: %u tags, %u entered, %u left\n", index, event->count, event->enteredCount, event->leftCount);
 
-	initRfidReader(data->clockDivider);
+	// Unreported changes stay in the tracker, a change held back by a full
+	// ring is part of the next cycle's one
+	if ((event->enteredCount == 0 && event->leftCount == 0) || !emitEvent(data, event))
+		return;
 
-	try
+	for (i = p->count; i-- > 0;)
 	{
-		for (;;)
+		if (p->tags[i].state == PRESENCE_GONE)
+			presence_remove(p, i);
+		else if (p->tags[i].state == PRESENCE_PRESENT)
+			p->tags[i].reported = 1;
+	}
+}
+
+// Handle the answer to the reader's WUPA in the configured mode
+void finishCycle(Data *data, uint32_t index, tag_stat statusRfidReader, uint16_t atqa)
+{
+	if (data->inventory)
+		inventoryReader(data, index, statusRfidReader);
+	else
+		finishReader(data, index, statusRfidReader, atqa);
+}
+
+void freeJobData(napi_env env, void *data, void *hint)
+{
+	delete[] (uint8_t *)data;
+}
+
+// A Buffer over the job's result; it takes over job->data if it can
+napi_value createJobBuffer(napi_env env, Job *job)
+{
+	napi_value buffer;
+	if (napi_create_external_buffer(env, job->length, job->data, freeJobData, NULL, &buffer) == napi_ok)
+	{
+		job->data = NULL;
+		return buffer;
+	}
+	assert(napi_create_buffer_copy(env, job->length, job->data, NULL, &buffer) == napi_ok);
+	return buffer;
+}
+
+// An Error with the code and message of a BLOCK_* status
+napi_value createBlockError(napi_env env, uint8_t status)
+{
+	const BlockError *error = blockError(status);
+	napi_value result, code, message;
+	assert(napi_create_string_utf8(env, error ? error->code : "ERROR", NAPI_AUTO_LENGTH, &code) == napi_ok);
+	assert(napi_create_string_utf8(env, error ? error->message : "Failed", NAPI_AUTO_LENGTH, &message) == napi_ok);
+	assert(napi_create_error(env, code, message, &result) == napi_ok);
+	return result;
+}
+
+// data.subarray(offset, offset + length), a Buffer sharing data's memory
+napi_value subarray(napi_env env, napi_value data, uint32_t offset, uint32_t length)
+{
+	napi_value method, args[2], result;
+	assert(napi_get_named_property(env, data, "subarray", &method) == napi_ok);
+	assert(napi_create_uint32(env, offset, &args[0]) == napi_ok);
+	assert(napi_create_uint32(env, offset + length, &args[1]) == napi_ok);
+	assert(napi_call_function(env, data, method, 2, args, &result) == napi_ok);
+	return result;
+}
+
+// { message, records: [{ tnf, type, id, payload }] }, all Buffers are views
+// of the memory the tag was read into
+napi_value createNdefResult(napi_env env, Job *job)
+{
+	napi_value result, data, message, records, record, value;
+	assert(napi_create_object(env, &result) == napi_ok);
+	data = createJobBuffer(env, job);
+	message = subarray(env, data, job->messageStart, job->messageLength);
+	assert(napi_set_named_property(env, result, "message", message) == napi_ok);
+	assert(napi_create_array_with_length(env, job->recordCount, &records) == napi_ok);
+	for (uint8_t i = 0; i < job->recordCount; i++)
+	{
+		const ndef_record *r = &job->records[i];
+		assert(napi_create_object(env, &record) == napi_ok);
+		assert(napi_create_uint32(env, r->header & 0x07, &value) == napi_ok);
+		assert(napi_set_named_property(env, record, "tnf", value) == napi_ok);
+		assert(napi_set_named_property(env, record, "type", subarray(env, message, r->typeOffset, r->typeLength)) == napi_ok);
+		assert(napi_set_named_property(env, record, "id", subarray(env, message, r->idOffset, r->idLength)) == napi_ok);
+		assert(napi_set_named_property(env, record, "payload", subarray(env, message, r->payloadOffset, r->payloadLength)) == napi_ok);
+		assert(napi_set_element(env, records, i, record) == napi_ok);
+	}
+	assert(napi_set_named_property(env, result, "records", records) == napi_ok);
+	return result;
+}
+
+// Resolve the job's promise with its result, or reject it
+void settleJob(napi_env env, Job *job)
+{
+	napi_value result, sectors, code, value;
+	if (job->status != BLOCK_OK)
+	{
+		result = createBlockError(env, job->status);
+		if (job->type == JOB_WRITE && job->status != BLOCK_NOREADER)
+		{
+			// Blocks before the failed one are written
+			assert(napi_create_uint32(env, job->failed, &value) == napi_ok);
+			assert(napi_set_named_property(env, result, "block", value) == napi_ok);
+			assert(napi_create_uint32(env, job->written, &value) == napi_ok);
+			assert(napi_set_named_property(env, result, "written", value) == napi_ok);
+		}
+		assert(napi_reject_deferred(env, job->deferred, result) == napi_ok);
+		return;
+	}
+
+	if (job->type == JOB_DUMP)
+	{
+		// { data, sectors: [null | error code per sector] }
+		assert(napi_create_object(env, &result) == napi_ok);
+		assert(napi_set_named_property(env, result, "data", createJobBuffer(env, job)) == napi_ok);
+		assert(napi_create_array_with_length(env, job->sectors, &sectors) == napi_ok);
+		for (uint8_t i = 0; i < job->sectors; i++)
 		{
-			InitRc522();
+			const BlockError *error = blockError(job->sectorStatus[i]);
+			if (error == NULL)
+				assert(napi_get_null(env, &code) == napi_ok);
+			else
+				assert(napi_create_string_utf8(env, error->code, NAPI_AUTO_LENGTH, &code) == napi_ok);
+			assert(napi_set_element(env, sectors, i, code) == napi_ok);
+		}
+		assert(napi_set_named_property(env, result, "sectors", sectors) == napi_ok);
+	}
+	else if (job->type == JOB_NDEF)
+	{
+		result = createNdefResult(env, job);
+	}
+	else if (job->type == JOB_WRITE)
+	{
+		// { written, skipped }
+		assert(napi_create_object(env, &result) == napi_ok);
+		assert(napi_create_uint32(env, job->written, &value) == napi_ok);
+		assert(napi_set_named_property(env, result, "written", value) == napi_ok);
+		assert(napi_create_uint32(env, job->count - job->written, &value) == napi_ok);
+		assert(napi_set_named_property(env, result, "skipped", value) == napi_ok);
+	}
+	else
+	{
+		result = createJobBuffer(env, job);
+	}
+	assert(napi_resolve_deferred(env, job->deferred, result) == napi_ok);
+}
 
-			statusRfidReader = find_tag(&CType);
-			int selectResult;
+void deleteJob(Job *job)
+{
+	delete[] job->data;
+	delete[] job->keys;
+	delete[] job->records;
+	delete job;
+}
 
-			if (statusRfidReader == TAG_NOTAG)
-			{
-				if (data->debug)
-					printf("No tag found\n");
+bool isStopping(Data *data)
+{
+	std::lock_guard<std::mutex> lock(data->mutex);
+	return data->stopping;
+}
 
-				foundTag = false;
-			}
-			else if (statusRfidReader != TAG_OK && statusRfidReader != TAG_COLLISION)
-			{
-				if (data->debug)
-					printf("Unexpected status: %d\n", statusRfidReader);
-			}
-			else if ((selectResult = select_tag_sn(serialNumber, &serialNumberLength)) != TAG_OK)
-			{
-				if (data->debug)
-					printf("Failed to select tag: %d\n", selectResult);
-			}
-			else if (serialNumberLength > 10)
+void stopInstance(napi_env env);
+
+// Settles a job the reader thread finished. Without a job the reader thread
+// gave up, see abandonInstance.
+void jobCallbackProcessor(napi_env env, napi_value js_cb,
+						  void *context, void *data)
+{
+	if (data == NULL)
+	{
+		if (env != NULL && instance != NULL && isStopping(instance))
+			stopInstance(env);
+		return;
+	}
+	if (env != NULL)
+	{
+		settleJob(env, (Job *)data);
+	}
+	deleteJob((Job *)data);
+}
+
+// Run the queued jobs, polling continues once the queue is empty
+void runJobs(Data *data)
+{
+	Job *job;
+	Reader *reader;
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> lock(data->mutex);
+			// Jobs left at a stop are rejected by stopInstance
+			if (data->jobs.empty() || data->stopping)
+				break;
+			job = data->jobs.front();
+			data->jobs.pop_front();
+		}
+
+		rfid_keys keys = {job->keys, job->keyCount, data->cache.capacity ? &data->cache : NULL};
+		reader = &data->readers[job->reader];
+		reader->halted = reader->open;
+		if (!reader->open)
+		{
+			job->status = BLOCK_NOREADER;
+		}
+		else if (job->type == JOB_DUMP)
+		{
+			Rc522Select(&reader->dev);
+			job->status = dump_tag(job->uid, job->uidLength, &keys, job->data, &job->sectors, job->sectorStatus);
+			job->length = job->sectors ? (sector_first_block(job->sectors - 1) + sector_blocks(job->sectors - 1)) * 16 : 0;
+			for (uint8_t i = 0; i < job->sectors; i++)
 			{
-				if (data->debug)
-					printf("Serial number too long: %d\n", serialNumberLength);
+				if (job->sectorStatus[i] == BLOCK_OK)
+					image_store(&reader->image, job->uid, job->uidLength, sector_first_block(i), sector_blocks(i),
+								job->data + sector_first_block(i) * 16);
 			}
-			else
+		}
+		else if (job->type == JOB_WRITE)
+		{
+			Rc522Select(&reader->dev);
+			job->status = write_tag_blocks(job->uid, job->uidLength, job->block, job->count, &keys, job->data,
+										   job->verify, &reader->image, &job->written, &job->failed);
+		}
+		else if (job->type == JOB_PAGES)
+		{
+			uint16_t pages;
+			Rc522Select(&reader->dev);
+			job->status = read_tag_pages(job->uid, job->uidLength, job->block, job->count, job->data, &pages);
+			job->length = pages * 4;
+		}
+		else if (job->type == JOB_NDEF)
+		{
+			Rc522Select(&reader->dev);
+			job->status = read_tag_ndef(job->uid, job->uidLength, job->data, &job->messageStart, &job->messageLength);
+			job->length = job->messageStart + job->messageLength;
+			if (job->status == BLOCK_OK && ndef_records(job->data + job->messageStart, job->messageLength,
+														job->records, NDEF_MAX_RECORDS, &job->recordCount) != 0)
+				job->status = BLOCK_NDEF;
+		}
+		else
+		{
+			Rc522Select(&reader->dev);
+			job->status = read_tag_blocks(job->uid, job->uidLength, job->block, job->count, &keys, job->data);
+			if (job->status == BLOCK_OK)
+				image_store(&reader->image, job->uid, job->uidLength, job->block, job->count, job->data);
+		}
+
+		// The tag left, what it holds when it is back is unknown
+		if (job->status == BLOCK_NOTAG || (job->sectors && job->sectorStatus[job->sectors - 1] == BLOCK_NOTAG))
+		{
+			if (image_holds(&reader->image, job->uid, job->uidLength))
+				image_clear(&reader->image);
+		}
+
+		if (data->debug)
+			printf("Job %u on reader %u: block %u+%u status %u\n", job->type, job->reader, job->block, job->count, job->status);
+
+		if (data->cache.dirty && data->keyCacheFile[0] != 0 && keycache_save(&data->cache, data->keyCacheFile) != 0)
+			printf("Failed to save key cache %s\n", data->keyCacheFile);
+		{
+			std::lock_guard<std::mutex> lock(data->mutex);
+			data->cacheHits = data->cache.hits;
+			data->cacheMisses = data->cache.misses;
+			data->cacheEntries = data->cache.count;
+		}
+
+		assert(napi_call_threadsafe_function(data->jobCallback, job, napi_tsfn_nonblocking) == napi_ok);
+	}
+
+	// A HALTed tag answers the WUPA of the next inventory but drops out of
+	// it at the first REQA if it loses the anticollision, and would be
+	// reported gone. The field reset puts it back to IDLE.
+	for (uint32_t i = 0; i < data->readerCount; i++)
+	{
+		reader = &data->readers[i];
+		if (!reader->halted)
+			continue;
+		reader->halted = false;
+		if (!data->inventory)
+			continue;
+		Rc522Select(&reader->dev);
+		PcdFieldReset(INVENTORY_FIELD_RESET_US);
+	}
+}
+
+
+// The reader thread ends without a stop, no reader could be opened or the
+// loop failed. New jobs are rejected from now on and the JS thread is asked
+// to free the instance, which rejects those queued and releases the
+// threadsafe functions, so the process can exit.
+void abandonInstance(Data *data)
+{
+	{
+		std::lock_guard<std::mutex> lock(data->mutex);
+		data->stopping = true;
+	}
+	assert(napi_call_threadsafe_function(data->jobCallback, NULL, napi_tsfn_nonblocking) == napi_ok);
+}
+
+// The poll loop, on the reader thread until stopInstance asks it to end
+void execute(Data *data)
+{
+	Reader *reader;
+	uint16_t CType = 0;
+	tag_stat statusRfidReader;
+	uint32_t i, remaining, pollUs, opened = 0;
+	int64_t interval;
+	bool active, idle;
+
+	if (data->keyCacheFile[0] != 0 && keycache_load(&data->cache, data->keyCacheFile) == 0 && data->debug)
+		printf("Loaded %u keys from %s\n", data->cache.count, data->keyCacheFile);
+
+	for (i = 0; i < data->readerCount; i++)
+	{
+		if (initRfidReader(&data->readers[i]) != 0)
+		{
+			printf("Failed to initialize reader %u\n", i);
+			continue;
+		}
+		InitRc522();
+		opened++;
+	}
+	if (opened == 0)
+	{
+		abandonInstance(data);
+		return;
+	}
+
+	try
+	{
+		while (!isStopping(data))
+		{
+			// Every reader gets its WUPA before any of them is waited for, so
+			// their RF exchanges and timeouts overlap instead of adding up
+			remaining = 0;
+			for (i = 0; i < data->readerCount; i++)
 			{
-				foundTag = true;
-				for (p = uid, loopCounter = 0; loopCounter < serialNumberLength; loopCounter++)
+				reader = &data->readers[i];
+				if (!reader->open)
+					continue;
+
+				Rc522Select(&reader->dev);
+				if (PcdCheck() != TAG_OK)
 				{
-					sprintf(p, "%02x", serialNumber[loopCounter]);
-					p += 2;
+					if (data->debug)
+						printf("Reader %u fault, resetting\n", i);
+
+					InitRc522();
 				}
 
-				if (data->debug)
-					printf("Tag: %s\n", uid);
+				reader->cycleStart = monotonicNs();
+				find_tag_start();
+				reader->pending = true;
+				reader->polls = 0;
+				remaining++;
 			}
 
-			if (foundTag != lastFoundTag || strcmp(uid, lastUid) != 0)
+			// Serve whichever reader finished first; selecting its tag keeps
+			// the host busy while the others are still waiting on the air.
+			// Their WUPAs are answered or timed out after PCD_PROBE_US.
+			for (pollUs = PCD_PROBE_US; remaining > 1; pollUs = 200)
 			{
-				char *uidCopy = NULL;
-				if (foundTag)
+				sleepReaders(data, pollUs);
+				for (i = 0; i < data->readerCount; i++)
 				{
-					uidCopy = new char[23];
-					strcpy(uidCopy, uid);
+					reader = &data->readers[i];
+					if (!reader->pending)
+						continue;
+
+					Rc522Select(&reader->dev);
+					uint8_t done = PcdComMF522Poll();
+					if (!done && ++reader->polls < 150)
+						continue;
+
+					reader->pending = false;
+					remaining--;
+					statusRfidReader = find_tag_finish(&CType, done);
+					finishCycle(data, i, statusRfidReader, CType);
 				}
+			}
+
+			// The last one may block, on its IRQ pin if it has one
+			for (i = 0; i < data->readerCount; i++)
+			{
+				reader = &data->readers[i];
+				if (!reader->pending)
+					continue;
 
-				assert(napi_call_threadsafe_function(data->callback, uidCopy, napi_tsfn_nonblocking) == napi_ok);
+				Rc522Select(&reader->dev);
+				reader->pending = false;
+				statusRfidReader = find_tag_finish(&CType, PcdComMF522Wait());
+				finishCycle(data, i, statusRfidReader, CType);
 			}
 
-			lastFoundTag = foundTag;
-			strcpy(lastUid, uid);
-			usleep(data->delay * 1000);
+			active = false;
+			for (i = 0; i < data->readerCount; i++)
+				active = active || data->readers[i].tracker.count > 0;
+			interval = nextInterval(data, active, &idle);
+			if (idle && data->powerSave != POWER_SAVE_OFF)
+				powerSaveReaders(data);
+
+			// Sleep until the next poll, or until JS queues a job; a batch
+			// due meanwhile goes out before the poll
+			{
+				std::chrono::milliseconds wait = flushEvents(data, interval);
+				std::unique_lock<std::mutex> lock(data->mutex);
+				// A job is activity as well, polling speeds up again
+				if (data->wakeup.wait_for(lock, wait, [data]
+										  { return !data->jobs.empty() || data->stopping; }))
+					data->lastActivity = monotonicNs();
+			}
+			flushEvents(data, interval);
+			if (isStopping(data))
+				break;
+			wakeReaders(data);
+			runJobs(data);
 		}
 	}
 	catch (...)
 	{
 		printf("Exception\n");
-		bcm2835_spi_end();
-		bcm2835_close();
-		throw;
+		for (i = 0; i < data->readerCount; i++)
+			closeRfidReader(&data->readers[i]);
+		abandonInstance(data);
+		return;
 	}
 
-	// assert(napi_release_threadsafe_function(data->callback, napi_tsfn_release) == napi_ok);
+	// Events still waiting for their batch to fill up
+	if (data->eventsPending)
+		signalEvents(data);
+
+	// Ends SPI and the bcm2835 library with the last reader
+	for (i = 0; i < data->readerCount; i++)
+		closeRfidReader(&data->readers[i]);
 }
 
-void onComplete(napi_env env, napi_status status, void *dataIn)
+// Stop the reader thread, waiting for the cycle or job it is in, and free
+// the instance. Queued jobs are rejected, unless env is NULL because the
+// environment is being torn down.
+void stopInstance(napi_env env)
 {
-	Data *data = (Data *)dataIn;
-	assert(napi_release_threadsafe_function(data->callback, napi_tsfn_release) == napi_ok);
-	assert(napi_delete_async_work(env, data->work) == napi_ok);
+	Data *data = instance;
+	if (data == NULL)
+		return;
+	instance = NULL;
+
+	{
+		std::lock_guard<std::mutex> lock(data->mutex);
+		data->stopping = true;
+	}
+	data->wakeup.notify_one();
+	data->thread.join();
+
+	for (Job *job : data->jobs)
+	{
+		job->status = BLOCK_NOREADER;
+		if (env != NULL)
+			settleJob(env, job);
+		deleteJob(job);
+	}
+	// Without the threadsafe functions nothing keeps the event loop alive
+	if (env != NULL)
+	{
+		assert(napi_release_threadsafe_function(data->callback, napi_tsfn_release) == napi_ok);
+		assert(napi_release_threadsafe_function(data->jobCallback, napi_tsfn_release) == napi_ok);
+	}
+	for (uint32_t i = 0; i < data->readerCount; i++)
+		delete data->readers[i].sim;
+	delete[] data->readers;
+	keycache_free(&data->cache);
 	delete data;
 }
 
+// stop() ends polling and releases the readers, start can be called again
+napi_value stop(napi_env env, napi_callback_info info)
+{
+	stopInstance(env);
+	return NULL;
+}
+
+// The thread must not outlive the environment, e.g. a worker that exits
+void cleanup(void *arg)
+{
+	stopInstance(NULL);
+}
+
+// options.readers[i] = { clockDivider, chipSelect, csPin, resetPin, irqPin, crcOffload, spidev, simulator? }
+void parseReader(napi_env env, napi_value options, Reader *reader)
+{
+	napi_value clockDivider, chipSelect, csPin, resetPin, irqPin, crcOffload, spidev, simulator;
+	size_t length;
+	bool hasSimulator;
+	assert(napi_get_named_property(env, options, "clockDivider", &clockDivider) == napi_ok);
+	assert(napi_get_named_property(env, options, "chipSelect", &chipSelect) == napi_ok);
+	assert(napi_get_named_property(env, options, "csPin", &csPin) == napi_ok);
+	assert(napi_get_named_property(env, options, "resetPin", &resetPin) == napi_ok);
+	assert(napi_get_named_property(env, options, "irqPin", &irqPin) == napi_ok);
+	assert(napi_get_named_property(env, options, "crcOffload", &crcOffload) == napi_ok);
+	assert(napi_get_named_property(env, options, "spidev", &spidev) == napi_ok);
+
+	assert(napi_get_value_int64(env, clockDivider, &reader->clockDivider) == napi_ok);
+	assert(napi_get_value_int64(env, chipSelect, &reader->chipSelect) == napi_ok);
+	assert(napi_get_value_int64(env, csPin, &reader->csPin) == napi_ok);
+	assert(napi_get_value_int64(env, resetPin, &reader->resetPin) == napi_ok);
+	assert(napi_get_value_int64(env, irqPin, &reader->irqPin) == napi_ok);
+	assert(napi_get_value_bool(env, crcOffload, &reader->crcOffload) == napi_ok);
+	assert(napi_get_value_string_utf8(env, spidev, reader->spidev, sizeof(reader->spidev), &length) == napi_ok);
+	reader->sim = NULL;
+	assert(napi_has_named_property(env, options, "simulator", &hasSimulator) == napi_ok);
+	if (hasSimulator)
+	{
+		assert(napi_get_named_property(env, options, "simulator", &simulator) == napi_ok);
+		reader->sim = createSimulator(env, simulator);
+	}
+
+	reader->open = false;
+	reader->asleep = false;
+	reader->halted = false;
+	reader->pending = false;
+	image_clear(&reader->image);
+}
+
 napi_value start(napi_env env, napi_callback_info info)
 {
 	size_t argc = 2;
 	napi_value args[2];
 	assert(napi_get_cb_info(env, info, &argc, args, NULL, NULL) == napi_ok);
-	napi_value delay, clockDivider, debug;
+	napi_value delay, debug, inventory, keyCacheSize, keyCacheFile, eventQueueSize, overflow, batchSize, batchLatency, uidFormat;
+	napi_value presentAfter, absentAfter, absentTime, idleDelay, activeWindow, powerSave, readers, reader;
+	uint32_t cacheSize, queueSize, eventBatchSize, presentCycles, absentCycles;
+	int64_t absentMs;
+	char overflowName[16], uidFormatName[16], powerSaveName[16];
+	size_t length;
 	assert(napi_get_named_property(env, args[0], "delay", &delay) == napi_ok);
-	assert(napi_get_named_property(env, args[0], "clockDivider", &clockDivider) == napi_ok);
 	assert(napi_get_named_property(env, args[0], "debug", &debug) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "inventory", &inventory) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "keyCacheSize", &keyCacheSize) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "keyCacheFile", &keyCacheFile) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "eventQueueSize", &eventQueueSize) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "overflow", &overflow) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "batchSize", &batchSize) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "batchLatency", &batchLatency) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "uidFormat", &uidFormat) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "presentAfter", &presentAfter) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "absentAfter", &absentAfter) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "absentTime", &absentTime) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "idleDelay", &idleDelay) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "activeWindow", &activeWindow) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "powerSave", &powerSave) == napi_ok);
+	assert(napi_get_named_property(env, args[0], "readers", &readers) == napi_ok);
 	napi_value jsCallback = args[1]; // Second param, the JS callback function
 
+	// A restart replaces the running instance
+	stopInstance(env);
+
 	// Specify a name to describe this asynchronous operation.
 	napi_value workName;
 	assert(napi_create_string_utf8(env, "Work", NAPI_AUTO_LENGTH, &workName) == napi_ok);
@@ -176,11 +1439,47 @@ napi_value start(napi_env env, napi_callback_info info)
 	// Create a thread-safe N-API callback function correspond to the C/C++ callback function
 	Data *data = new Data;
 	assert(napi_get_value_int64(env, delay, &data->delay) == napi_ok);
-	assert(napi_get_value_int64(env, clockDivider, &data->clockDivider) == napi_ok);
+	assert(napi_get_value_int64(env, idleDelay, &data->idleDelay) == napi_ok);
+	assert(napi_get_value_int64(env, activeWindow, &data->activeWindow) == napi_ok);
+	assert(napi_get_value_string_utf8(env, powerSave, powerSaveName, sizeof(powerSaveName), &length) == napi_ok);
+	data->powerSave = strcmp(powerSaveName, "antenna") == 0 ? POWER_SAVE_ANTENNA : strcmp(powerSaveName, "powerDown") == 0 ? POWER_SAVE_POWER_DOWN : POWER_SAVE_OFF;
+	data->interval = data->delay;
+	data->lastActivity = monotonicNs();
 	assert(napi_get_value_bool(env, debug, &data->debug) == napi_ok);
-	assert(napi_create_threadsafe_function(env, jsCallback, NULL, workName, 0, 1, NULL, NULL, NULL, jsCallbackProcessor, &data->callback) == napi_ok);
-	assert(napi_create_async_work(env, NULL, workName, execute, onComplete, data, &data->work) == napi_ok);
-	assert(napi_queue_async_work(env, data->work) == napi_ok);
+	assert(napi_get_value_bool(env, inventory, &data->inventory) == napi_ok);
+	assert(napi_get_value_uint32(env, keyCacheSize, &cacheSize) == napi_ok);
+	assert(napi_get_value_string_utf8(env, keyCacheFile, data->keyCacheFile, sizeof(data->keyCacheFile), &length) == napi_ok);
+	if (keycache_init(&data->cache, cacheSize) != 0)
+		printf("Failed to allocate the key cache\n");
+	data->cacheHits = 0;
+	data->cacheMisses = 0;
+	data->cacheEntries = 0;
+	data->stopping = false;
+	assert(napi_get_value_uint32(env, eventQueueSize, &queueSize) == napi_ok);
+	assert(napi_get_value_string_utf8(env, overflow, overflowName, sizeof(overflowName), &length) == napi_ok);
+	assert(napi_get_value_uint32(env, batchSize, &eventBatchSize) == napi_ok);
+	assert(napi_get_value_int64(env, batchLatency, &data->batchLatency) == napi_ok);
+	data->eventsPending = false;
+	assert(napi_get_value_string_utf8(env, uidFormat, uidFormatName, sizeof(uidFormatName), &length) == napi_ok);
+	data->events = createEventRing(queueSize, strcmp(overflowName, "dropOldest") == 0 ? OVERFLOW_DROP_OLDEST : OVERFLOW_COALESCE, eventBatchSize,
+								   strcmp(uidFormatName, "buffer") == 0);
+	assert(napi_get_array_length(env, readers, &data->readerCount) == napi_ok);
+	assert(napi_get_value_uint32(env, presentAfter, &presentCycles) == napi_ok);
+	assert(napi_get_value_uint32(env, absentAfter, &absentCycles) == napi_ok);
+	assert(napi_get_value_int64(env, absentTime, &absentMs) == napi_ok);
+	data->readers = new Reader[data->readerCount];
+	for (uint32_t i = 0; i < data->readerCount; i++)
+	{
+		assert(napi_get_element(env, readers, i, &reader) == napi_ok);
+		parseReader(env, reader, &data->readers[i]);
+		presence_init(&data->readers[i].tracker, presentCycles, absentCycles, absentMs > 0 ? absentMs * 1000000 : 0);
+	}
+	assert(napi_create_threadsafe_function(env, jsCallback, NULL, workName, 0, 1, data->events, freeEventRing, data->events, jsCallbackProcessor, &data->callback) == napi_ok);
+	assert(napi_create_threadsafe_function(env, NULL, NULL, workName, 0, 1, NULL, NULL, NULL, jobCallbackProcessor, &data->jobCallback) == napi_ok);
+	instance = data;
+	// A thread of its own, the poll loop never ends and would hold one of
+	// the few threads of the libuv pool
+	data->thread = std::thread(execute, data);
 
 	printf("Started\n");
 
@@ -188,14 +1487,306 @@ napi_value start(napi_env env, napi_callback_info info)
 	return NULL;
 }
 
+// A job for the tag uid on reader. keys holds 7 byte records, the key type
+// (0 for A, 1 for B) followed by the key.
+Job *createJob(napi_env env, uint8_t type, napi_value reader, napi_value uid, napi_value keys, napi_value *promise)
+{
+	void *buffer;
+	size_t length;
+
+	Job *job = new Job;
+	job->type = type;
+	job->data = NULL;
+	job->length = 0;
+	job->sectors = 0;
+	job->block = 0;
+	job->count = 0;
+	job->verify = false;
+	job->written = 0;
+	job->failed = 0;
+	job->messageStart = 0;
+	job->messageLength = 0;
+	job->records = NULL;
+	job->recordCount = 0;
+	assert(napi_create_promise(env, &job->deferred, promise) == napi_ok);
+	assert(napi_get_value_uint32(env, reader, &job->reader) == napi_ok);
+	assert(napi_get_buffer_info(env, uid, &buffer, &length) == napi_ok);
+	job->uidLength = length <= sizeof(job->uid) ? length : 0;
+	memcpy(job->uid, buffer, job->uidLength);
+	assert(napi_get_buffer_info(env, keys, &buffer, &length) == napi_ok);
+	job->keyCount = length / 7;
+	job->keys = new rfid_key[job->keyCount];
+	for (uint16_t i = 0; i < job->keyCount; i++)
+	{
+		uint8_t *record = (uint8_t *)buffer + i * 7;
+		job->keys[i].type = record[0] ? PICC_AUTHENT1B : PICC_AUTHENT1A;
+		memcpy(job->keys[i].key, record + 1, 6);
+	}
+	return job;
+}
+
+// Hand the job to the reader thread, or reject it if there is none
+void queueJob(napi_env env, Job *job)
+{
+	bool queued = false;
+	if (instance != NULL && job->reader < instance->readerCount)
+	{
+		std::lock_guard<std::mutex> lock(instance->mutex);
+		// The reader thread gave up and won't run it
+		if (!instance->stopping)
+		{
+			instance->jobs.push_back(job);
+			queued = true;
+		}
+	}
+	if (!queued)
+	{
+		job->status = BLOCK_NOREADER;
+		settleJob(env, job);
+		deleteJob(job);
+		return;
+	}
+	instance->wakeup.notify_one();
+}
+
+// readBlocks(reader, uid, block, count, keys) queues a read of count blocks
+// and returns a Promise for a Buffer with their contents
+napi_value readBlocks(napi_env env, napi_callback_info info)
+{
+	size_t argc = 5;
+	napi_value args[5], promise;
+	uint32_t value;
+	assert(napi_get_cb_info(env, info, &argc, args, NULL, NULL) == napi_ok);
+
+	Job *job = createJob(env, JOB_READ, args[0], args[1], args[4], &promise);
+	assert(napi_get_value_uint32(env, args[2], &value) == napi_ok);
+	job->block = value;
+	assert(napi_get_value_uint32(env, args[3], &value) == napi_ok);
+	job->count = value <= 16 ? value : 16;
+	job->length = job->count * 16;
+	job->data = new uint8_t[job->length];
+	queueJob(env, job);
+	return promise;
+}
+
+// writeBlocks(reader, uid, block, data, keys, verify) queues a write of data,
+// a multiple of 16 bytes, and returns a Promise for { written, skipped }
+napi_value writeBlocks(napi_env env, napi_callback_info info)
+{
+	size_t argc = 6;
+	napi_value args[6], promise;
+	uint32_t value;
+	void *buffer;
+	size_t length;
+	assert(napi_get_cb_info(env, info, &argc, args, NULL, NULL) == napi_ok);
+
+	Job *job = createJob(env, JOB_WRITE, args[0], args[1], args[4], &promise);
+	assert(napi_get_value_uint32(env, args[2], &value) == napi_ok);
+	job->block = value;
+	assert(napi_get_buffer_info(env, args[3], &buffer, &length) == napi_ok);
+	job->count = length / 16 <= 16 ? length / 16 : 16;
+	job->data = new uint8_t[job->count * 16];
+	memcpy(job->data, buffer, job->count * 16);
+	assert(napi_get_value_bool(env, args[5], &job->verify) == napi_ok);
+	queueJob(env, job);
+	return promise;
+}
+
+// readPages(reader, uid, page, count) queues a read of count pages of an
+// Ultralight/NTAG21x, 0 for all from page on, and returns a Promise for a
+// Buffer with their contents
+napi_value readPages(napi_env env, napi_callback_info info)
+{
+	size_t argc = 4;
+	napi_value args[4], promise, keys;
+	uint32_t value;
+	assert(napi_get_cb_info(env, info, &argc, args, NULL, NULL) == napi_ok);
+
+	// No authentication
+	assert(napi_create_buffer(env, 0, NULL, &keys) == napi_ok);
+	Job *job = createJob(env, JOB_PAGES, args[0], args[1], keys, &promise);
+	assert(napi_get_value_uint32(env, args[2], &value) == napi_ok);
+	job->block = value;
+	assert(napi_get_value_uint32(env, args[3], &value) == napi_ok);
+	job->count = value <= PAGES_MAX ? value : PAGES_MAX;
+	job->data = new uint8_t[PAGES_MAX_BYTES + 2];
+	queueJob(env, job);
+	return promise;
+}
+
+// readNdef(reader, uid) queues a read of the NDEF message of a Type 2 tag,
+// returns a Promise for { message, records }
+napi_value readNdef(napi_env env, napi_callback_info info)
+{
+	size_t argc = 2;
+	napi_value args[2], promise, keys;
+	assert(napi_get_cb_info(env, info, &argc, args, NULL, NULL) == napi_ok);
+
+	assert(napi_create_buffer(env, 0, NULL, &keys) == napi_ok);
+	Job *job = createJob(env, JOB_NDEF, args[0], args[1], keys, &promise);
+	job->data = new uint8_t[PAGES_MAX_BYTES + 2];
+	job->records = new ndef_record[NDEF_MAX_RECORDS];
+	queueJob(env, job);
+	return promise;
+}
+
+// dumpCard(reader, uid, keys) reads a whole MIFARE Classic, returns a
+// Promise for { data, sectors }
+napi_value dumpCard(napi_env env, napi_callback_info info)
+{
+	size_t argc = 3;
+	napi_value args[3], promise;
+	assert(napi_get_cb_info(env, info, &argc, args, NULL, NULL) == napi_ok);
+
+	Job *job = createJob(env, JOB_DUMP, args[0], args[1], args[2], &promise);
+	job->data = new uint8_t[CLASSIC_MAX_BYTES];
+	queueJob(env, job);
+	return promise;
+}
+
+// keyCacheStats() returns { hits, misses, entries } of the key cache
+napi_value keyCacheStats(napi_env env, napi_callback_info info)
+{
+	napi_value result, value;
+	uint64_t hits = 0, misses = 0;
+	uint32_t entries = 0;
+
+	if (instance != NULL)
+	{
+		std::lock_guard<std::mutex> lock(instance->mutex);
+		hits = instance->cacheHits;
+		misses = instance->cacheMisses;
+		entries = instance->cacheEntries;
+	}
+	assert(napi_create_object(env, &result) == napi_ok);
+	assert(napi_create_int64(env, hits, &value) == napi_ok);
+	assert(napi_set_named_property(env, result, "hits", value) == napi_ok);
+	assert(napi_create_int64(env, misses, &value) == napi_ok);
+	assert(napi_set_named_property(env, result, "misses", value) == napi_ok);
+	assert(napi_create_uint32(env, entries, &value) == napi_ok);
+	assert(napi_set_named_property(env, result, "entries", value) == napi_ok);
+	return result;
+}
+
+// pauseEvents(paused) stops or resumes draining the event ring
+napi_value pauseEvents(napi_env env, napi_callback_info info)
+{
+	size_t argc = 1;
+	napi_value args[1];
+	bool paused;
+
+	assert(napi_get_cb_info(env, info, &argc, args, NULL, NULL) == napi_ok);
+	assert(napi_get_value_bool(env, args[0], &paused) == napi_ok);
+	if (instance == NULL)
+		return NULL;
+
+	EventRing *ring = instance->events;
+	ring->paused = paused;
+	if (!paused)
+	{
+		// Events pushed while paused didn't queue a drain
+		ring->signalled = true;
+		assert(napi_call_threadsafe_function(instance->callback, NULL, napi_tsfn_nonblocking) == napi_ok);
+	}
+	return NULL;
+}
+
+// eventStats() returns { delivered, dropped, coalesced, queued } of the event
+// ring
+napi_value eventStats(napi_env env, napi_callback_info info)
+{
+	napi_value result, value;
+	uint64_t delivered = 0, dropped = 0, coalesced = 0;
+	uint32_t queued = 0;
+
+	if (instance != NULL)
+	{
+		EventRing *ring = instance->events;
+		delivered = ring->delivered;
+		dropped = ring->dropped;
+		coalesced = ring->coalesced;
+		queued = ringCount(ring, ring->head, ring->tail);
+	}
+	assert(napi_create_object(env, &result) == napi_ok);
+	assert(napi_create_int64(env, delivered, &value) == napi_ok);
+	assert(napi_set_named_property(env, result, "delivered", value) == napi_ok);
+	assert(napi_create_int64(env, dropped, &value) == napi_ok);
+	assert(napi_set_named_property(env, result, "dropped", value) == napi_ok);
+	assert(napi_create_int64(env, coalesced, &value) == napi_ok);
+	assert(napi_set_named_property(env, result, "coalesced", value) == napi_ok);
+	assert(napi_create_uint32(env, queued, &value) == napi_ok);
+	assert(napi_set_named_property(env, result, "queued", value) == napi_ok);
+	return result;
+}
+
 napi_value Init(napi_env env, napi_value exports)
 {
 	napi_value method;
 	napi_status status;
-	status = napi_create_function(env, "exports", NAPI_AUTO_LENGTH, start, NULL, &method);
+	status = napi_create_function(env, "start", NAPI_AUTO_LENGTH, start, NULL, &method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_set_named_property(env, exports, "start", method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_create_function(env, "stop", NAPI_AUTO_LENGTH, stop, NULL, &method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_set_named_property(env, exports, "stop", method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_create_function(env, "readBlocks", NAPI_AUTO_LENGTH, readBlocks, NULL, &method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_set_named_property(env, exports, "readBlocks", method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_create_function(env, "dumpCard", NAPI_AUTO_LENGTH, dumpCard, NULL, &method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_set_named_property(env, exports, "dumpCard", method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_create_function(env, "readPages", NAPI_AUTO_LENGTH, readPages, NULL, &method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_set_named_property(env, exports, "readPages", method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_create_function(env, "readNdef", NAPI_AUTO_LENGTH, readNdef, NULL, &method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_set_named_property(env, exports, "readNdef", method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_create_function(env, "writeBlocks", NAPI_AUTO_LENGTH, writeBlocks, NULL, &method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_set_named_property(env, exports, "writeBlocks", method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_create_function(env, "keyCacheStats", NAPI_AUTO_LENGTH, keyCacheStats, NULL, &method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_set_named_property(env, exports, "keyCacheStats", method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_create_function(env, "pauseEvents", NAPI_AUTO_LENGTH, pauseEvents, NULL, &method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_set_named_property(env, exports, "pauseEvents", method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_create_function(env, "eventStats", NAPI_AUTO_LENGTH, eventStats, NULL, &method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_set_named_property(env, exports, "eventStats", method);
+	if (status != napi_ok)
+		return NULL;
+	status = napi_add_env_cleanup_hook(env, cleanup, NULL);
 	if (status != napi_ok)
 		return NULL;
-	return method;
+	return exports;
 }
 
-NAPI_MODULE(rc522, Init)
\ No newline at end of file
+NAPI_MODULE(rc522, Init)
@@ -0,0 +1,65 @@
+/*
+ * gpio_irq.c
+ *
+ *  RC522 IRQ pin through the kernel GPIO character device. Edges are queued
+ *  by the kernel, so the reader thread can sleep in poll() until the chip
+ *  signals the end of a command.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "transport.h"
+
+// The RC522 IRQ output is configured active low (ComIEnReg IRqInv), so we
+// wait for falling edges on the given BCM GPIO. Returns -1 on failure.
+int gpio_irq_open(uint8_t pin)
+{
+	struct gpioevent_request request = {0};
+	int chip;
+
+	chip = open("/dev/gpiochip0", O_RDONLY);
+	if (chip < 0)
+	{
+		return -1;
+	}
+
+	request.lineoffset = pin;
+	request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	request.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+	snprintf(request.consumer_label, sizeof(request.consumer_label), "rc522-irq");
+	if (ioctl(chip, GPIO_GET_LINEEVENT_IOCTL, &request) < 0)
+	{
+		close(chip);
+		return -1;
+	}
+	close(chip);
+
+	fcntl(request.fd, F_SETFL, fcntl(request.fd, F_GETFL) | O_NONBLOCK);
+	return request.fd;
+}
+
+uint8_t gpio_irq_wait(int fd, uint32_t timeout_us)
+{
+	struct gpioevent_data event;
+	struct gpiohandle_data level;
+	struct pollfd pfd;
+
+	// Drop edges of earlier commands, the level tells if we are done already
+	while (read(fd, &event, sizeof(event)) == sizeof(event))
+		;
+	if (ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &level) == 0 && level.values[0] == 0)
+	{
+		return 1;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, (timeout_us + 999) / 1000) <= 0)
+	{
+		return 0;
+	}
+	return read(fd, &event, sizeof(event)) == sizeof(event);
+}
@@ -0,0 +1,213 @@
+/*
+ * keycache.c
+ *
+ *  Fixed size table searched linearly, a few hundred entries cost
+ *  microseconds against milliseconds for one authentication. The file
+ *  written by keycache_save holds the entries from least to most recently
+ *  used, so loading it into a smaller cache keeps the newest ones.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "keycache.h"
+
+#define KEYCACHE_MAGIC "RC522KC1"
+#define KEYCACHE_RECORD 19
+
+uint8_t keycache_init(keycache *c, uint32_t capacity)
+{
+	memset(c, 0, sizeof(*c));
+	if (capacity == 0)
+		return 0;
+	c->entries = (keycache_entry *)calloc(capacity, sizeof(keycache_entry));
+	if (c->entries == NULL)
+		return 1;
+	c->capacity = capacity;
+	return 0;
+}
+
+void keycache_free(keycache *c)
+{
+	free(c->entries);
+	c->entries = NULL;
+	c->capacity = 0;
+	c->count = 0;
+}
+
+keycache_entry *keycache_find(keycache *c, const uint8_t *uid, uint8_t uidLen, uint8_t sector)
+{
+	uint32_t i;
+	keycache_entry *e;
+
+	for (i = 0; i < c->capacity; i++)
+	{
+		e = &c->entries[i];
+		if (e->used && e->sector == sector && e->uidLen == uidLen && memcmp(e->uid, uid, uidLen) == 0)
+		{
+			e->used = ++c->clock;
+			return e;
+		}
+	}
+	return NULL;
+}
+
+void keycache_put(keycache *c, const uint8_t *uid, uint8_t uidLen, uint8_t sector, uint8_t keyType, const uint8_t *key)
+{
+	keycache_entry *e, *victim = NULL;
+	uint32_t i;
+
+	if (c->capacity == 0)
+		return;
+
+	e = keycache_find(c, uid, uidLen, sector);
+	if (e == NULL)
+	{
+		// A free entry, or else the least recently used one
+		for (i = 0; i < c->capacity; i++)
+		{
+			e = &c->entries[i];
+			if (!e->used)
+			{
+				victim = e;
+				c->count++;
+				break;
+			}
+			if (victim == NULL || e->used < victim->used)
+				victim = e;
+		}
+		e = victim;
+		memcpy(e->uid, uid, uidLen);
+		e->uidLen = uidLen;
+		e->sector = sector;
+	}
+	else if (e->keyType == keyType && memcmp(e->key, key, 6) == 0)
+	{
+		return;
+	}
+
+	e->keyType = keyType;
+	memcpy(e->key, key, 6);
+	e->used = ++c->clock;
+	c->dirty = 1;
+}
+
+void keycache_remove(keycache *c, keycache_entry *e)
+{
+	e->used = 0;
+	c->count--;
+	c->dirty = 1;
+}
+
+static int keycache_compare(const void *a, const void *b)
+{
+	uint32_t ua = (*(const keycache_entry **)a)->used;
+	uint32_t ub = (*(const keycache_entry **)b)->used;
+	return ua < ub ? -1 : ua > ub;
+}
+
+uint8_t keycache_load(keycache *c, const char *path)
+{
+	uint8_t record[KEYCACHE_RECORD];
+	char magic[8];
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (f == NULL)
+		return 1;
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, KEYCACHE_MAGIC, sizeof(magic)) != 0)
+	{
+		fclose(f);
+		return 1;
+	}
+	while (fread(record, 1, sizeof(record), f) == sizeof(record))
+	{
+		if (record[10] == 4 || record[10] == 7 || record[10] == 10)
+			keycache_put(c, record, record[10], record[11], record[12], record + 13);
+	}
+	fclose(f);
+	c->dirty = 0;
+	return 0;
+}
+
+// Makes the rename of a file in the directory of path durable
+static void keycache_sync_dir(const char *path)
+{
+	char dir[4096];
+	const char *slash = strrchr(path, '/');
+	int fd;
+
+	if (slash == NULL)
+		strcpy(dir, ".");
+	else if (slash == path)
+		strcpy(dir, "/");
+	else if ((size_t)(slash - path) < sizeof(dir))
+	{
+		memcpy(dir, path, slash - path);
+		dir[slash - path] = 0;
+	}
+	else
+		return;
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return;
+	fsync(fd);
+	close(fd);
+}
+
+// Written to a temporary file first, which is synced before it replaces the
+// cache, so neither a crash nor a power loss leaves a truncated cache behind
+uint8_t keycache_save(keycache *c, const char *path)
+{
+	keycache_entry **order;
+	uint8_t record[KEYCACHE_RECORD];
+	char tmp[4096];
+	uint32_t i, n = 0;
+	FILE *f;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return 1;
+	order = (keycache_entry **)malloc((c->count ? c->count : 1) * sizeof(keycache_entry *));
+	if (order == NULL)
+		return 1;
+	for (i = 0; i < c->capacity && n < c->count; i++)
+	{
+		if (c->entries[i].used)
+			order[n++] = &c->entries[i];
+	}
+	qsort(order, n, sizeof(keycache_entry *), keycache_compare);
+
+	f = fopen(tmp, "wb");
+	if (f == NULL)
+	{
+		free(order);
+		return 1;
+	}
+	fwrite(KEYCACHE_MAGIC, 1, 8, f);
+	for (i = 0; i < n; i++)
+	{
+		memset(record, 0, sizeof(record));
+		memcpy(record, order[i]->uid, order[i]->uidLen);
+		record[10] = order[i]->uidLen;
+		record[11] = order[i]->sector;
+		record[12] = order[i]->keyType;
+		memcpy(record + 13, order[i]->key, 6);
+		fwrite(record, 1, sizeof(record), f);
+	}
+	free(order);
+	if (fflush(f) != 0 || fsync(fileno(f)) != 0)
+	{
+		fclose(f);
+		remove(tmp);
+		return 1;
+	}
+	if (fclose(f) != 0 || rename(tmp, path) != 0)
+	{
+		remove(tmp);
+		return 1;
+	}
+	keycache_sync_dir(path);
+	c->dirty = 0;
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * keycache.h
+ *
+ *  LRU cache of the MIFARE Classic key that last authenticated a sector of
+ *  a tag, so returning tags are authenticated with the first attempt
+ *  instead of walking a key dictionary.
+ */
+
+#ifndef KEYCACHE_H_
+#define KEYCACHE_H_
+
+#include <stdint.h>
+
+typedef struct keycache_entry
+{
+	uint8_t uid[10];
+	uint8_t uidLen;
+	uint8_t sector;
+	uint8_t keyType;
+	uint8_t key[6];
+	// LRU stamp, 0 if the entry is free
+	uint32_t used;
+} keycache_entry;
+
+typedef struct keycache
+{
+	keycache_entry *entries;
+	uint32_t capacity;
+	uint32_t count;
+	uint32_t clock;
+	// Set when entries changed since the last keycache_save
+	uint8_t dirty;
+	uint64_t hits;
+	uint64_t misses;
+} keycache;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    uint8_t keycache_init(keycache *c, uint32_t capacity);
+    void keycache_free(keycache *c);
+    keycache_entry *keycache_find(keycache *c, const uint8_t *uid, uint8_t uidLen, uint8_t sector);
+    void keycache_put(keycache *c, const uint8_t *uid, uint8_t uidLen, uint8_t sector, uint8_t keyType, const uint8_t *key);
+    void keycache_remove(keycache *c, keycache_entry *e);
+    uint8_t keycache_load(keycache *c, const char *path);
+    uint8_t keycache_save(keycache *c, const char *path);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KEYCACHE_H_ */
@@ -0,0 +1,131 @@
+/*
+ * ndef.c
+ *
+ *  TLV blocks of the data area (NFC Forum Type 2 Tag Operation 2.3.4): type,
+ *  one byte length or 0xFF and two bytes big endian, value. The first NDEF
+ *  Message TLV is the one reported; NULL TLVs are skipped, so are Lock and
+ *  Memory Control and proprietary TLVs, by their length.
+ */
+#include <string.h>
+#include "ndef.h"
+
+#define TLV_NULL 0x00
+#define TLV_NDEF 0x03
+#define TLV_TERMINATOR 0xFE
+
+#define STATE_TYPE 0
+#define STATE_LENGTH 1
+#define STATE_LENGTH3 2		// three byte length format
+#define STATE_VALUE 3		// waiting for the whole NDEF message
+#define STATE_DONE 4
+#define STATE_NONE 5
+#define STATE_ERROR 6
+
+void ndef_init(ndef_parser * p, uint16_t size) {
+	memset(p,0,sizeof(*p));
+	p->size=size;
+}
+
+// Bytes of the data area, counted from its start, that have to be fed for
+// the parser to get on
+uint16_t ndef_needed(const ndef_parser * p) {
+	uint16_t n;
+
+	switch (p->state) {
+	case STATE_TYPE: n=p->pos+1; break;
+	case STATE_LENGTH: n=p->pos+1; break;
+	case STATE_LENGTH3: n=p->pos+3; break;
+	case STATE_VALUE: n=p->messageStart+p->messageLength; break;
+	default: n=p->pos;
+	}
+	return n<p->size ? n : p->size;
+}
+
+// Parses on over the first len bytes of the data area, data always points
+// to its start. Returns NDEF_MORE until the outcome is known.
+uint8_t ndef_feed(ndef_parser * p, const uint8_t * data, uint16_t len) {
+	uint16_t length;
+
+	for (;;) {
+		switch (p->state) {
+		case STATE_TYPE:
+			if (p->pos>=p->size) {p->state=STATE_NONE; continue;}
+			if (len<=p->pos) {return NDEF_MORE;}
+			p->type=data[p->pos++];
+			if (p->type==TLV_NULL) {continue;}
+			p->state=p->type==TLV_TERMINATOR ? STATE_NONE : STATE_LENGTH;
+			continue;
+		case STATE_LENGTH:
+			if (p->pos>=p->size) {p->state=STATE_ERROR; continue;}
+			if (len<=p->pos) {return NDEF_MORE;}
+			if (data[p->pos]==0xFF) {p->state=STATE_LENGTH3; continue;}
+			length=data[p->pos++];
+			break;
+		case STATE_LENGTH3:
+			if (p->pos+3>p->size) {p->state=STATE_ERROR; continue;}
+			if (len<p->pos+3) {return NDEF_MORE;}
+			length=(data[p->pos+1]<<8)|data[p->pos+2];
+			p->pos+=3;
+			break;
+		case STATE_VALUE:
+			if (len<p->messageStart+p->messageLength) {return NDEF_MORE;}
+			p->state=STATE_DONE;
+			continue;
+		case STATE_DONE: return NDEF_DONE;
+		case STATE_NONE: return NDEF_NONE;
+		default: return NDEF_ERROR;
+		}
+
+		// The length of a TLV is known
+		if ((uint32_t)p->pos+length>p->size) {
+			p->state=STATE_ERROR;
+		}else if (p->type==TLV_NDEF) {
+			p->messageStart=p->pos;
+			p->messageLength=length;
+			p->state=STATE_VALUE;
+		}else{
+			p->pos+=length;
+			p->state=STATE_TYPE;
+		}
+	}
+}
+
+// Splits an NDEF message into up to max records. Returns 1 if it is
+// malformed or has more records.
+uint8_t ndef_records(const uint8_t * message, uint16_t length, ndef_record * records, uint8_t max,
+		uint8_t * count) {
+	uint32_t i=0, payloadLength;
+	ndef_record * r;
+
+	*count=0;
+	while (i<length) {
+		if (*count==max || i+3>length) {return 1;}
+		r=&records[*count];
+		r->header=message[i];
+		r->typeLength=message[i+1];
+		i+=2;
+		if (r->header&0x10) {
+			payloadLength=message[i++];
+		}else{
+			if (i+4>length) {return 1;}
+			payloadLength=((uint32_t)message[i]<<24)|(message[i+1]<<16)|(message[i+2]<<8)|message[i+3];
+			i+=4;
+		}
+		r->idLength=0;
+		if (r->header&0x08) {
+			if (i+1>length) {return 1;}
+			r->idLength=message[i++];
+		}
+		r->typeOffset=i;
+		r->idOffset=i+r->typeLength;
+		r->payloadOffset=r->idOffset+r->idLength;
+		// Compared without adding up, a 32 bit payload length would wrap
+		if (r->payloadOffset>length || payloadLength>(uint32_t)(length-r->payloadOffset)) {return 1;}
+		r->payloadLength=payloadLength;
+		i=r->payloadOffset+payloadLength;
+		(*count)++;
+		// Message End
+		if (r->header&0x40) {break;}
+	}
+	return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * ndef.h
+ *
+ *  NFC Forum Type 2 tag TLVs and NDEF records. The TLV parser is fed the
+ *  data area as it is read from the tag and tells how many bytes it needs
+ *  next, so reading stops right after the NDEF message. Records are
+ *  reported as offsets into the message, nothing is copied.
+ */
+
+#ifndef NDEF_H_
+#define NDEF_H_
+
+#include <stdint.h>
+
+#define NDEF_MORE 0			// feed more bytes, up to ndef_needed()
+#define NDEF_DONE 1			// the NDEF message is complete
+#define NDEF_NONE 2			// terminator or end of the data area, no message
+#define NDEF_ERROR 3		// malformed TLV
+
+#define NDEF_MAX_RECORDS 32
+
+typedef struct ndef_parser {
+	uint8_t state;
+	uint8_t type;		// of the TLV being parsed
+	uint16_t pos;		// next byte to parse, from the start of the data area
+	uint16_t size;		// of the data area
+	uint16_t messageStart;
+	uint16_t messageLength;
+} ndef_parser;
+
+typedef struct ndef_record {
+	uint8_t header;		// MB, ME, CF, SR, IL and TNF
+	uint16_t typeOffset;
+	uint8_t typeLength;
+	uint16_t idOffset;
+	uint8_t idLength;
+	uint16_t payloadOffset;
+	uint16_t payloadLength;
+} ndef_record;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    void ndef_init(ndef_parser * p, uint16_t size);
+    uint8_t ndef_feed(ndef_parser * p, const uint8_t * data, uint16_t len);
+    uint16_t ndef_needed(const ndef_parser * p);
+    uint8_t ndef_records(const uint8_t * message, uint16_t length, ndef_record * records, uint8_t max,
+                         uint8_t * count);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NDEF_H_ */
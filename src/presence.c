@@ -0,0 +1,106 @@
+/*
+ * presence.c
+ *
+ *  Tags are kept in the order they were first seen. A present tag that
+ *  turns absent before it was reported is dropped silently, as is a
+ *  candidate missed once. A gone tag stays until the caller reported it
+ *  and removes it; seen again before that it is present again, so a full
+ *  event queue never reports a tag leaving that came back meanwhile.
+ */
+#include <string.h>
+#include "presence.h"
+
+void presence_init(presence *p, uint32_t presentAfter, uint32_t absentAfter, uint64_t absentTime)
+{
+	memset(p, 0, sizeof(*p));
+	p->presentAfter = presentAfter > 0 ? presentAfter : 1;
+	p->absentAfter = absentAfter > 0 ? absentAfter : 1;
+	p->absentTime = absentTime;
+}
+
+void presence_remove(presence *p, uint8_t index)
+{
+	p->count--;
+	memmove(&p->tags[index], &p->tags[index + 1], (p->count - index) * sizeof(presence_tag));
+}
+
+static uint8_t same_uid(const rfid_uid *a, const rfid_uid *b)
+{
+	return a->len == b->len && memcmp(a->sn, b->sn, a->len) == 0;
+}
+
+static const rfid_uid *find_seen(const rfid_uid *seen, uint8_t count, const rfid_uid *uid)
+{
+	uint8_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (same_uid(&seen[i], uid))
+			return &seen[i];
+	}
+	return NULL;
+}
+
+static uint8_t is_tracked(const presence *p, const rfid_uid *uid)
+{
+	uint8_t i;
+
+	for (i = 0; i < p->count; i++)
+	{
+		if (same_uid(&p->tags[i].uid, uid))
+			return 1;
+	}
+	return 0;
+}
+
+// Counts a cycle that saw the count tags in seen, at now
+void presence_update(presence *p, const rfid_uid *seen, uint8_t count, uint64_t now)
+{
+	presence_tag *tag;
+	const rfid_uid *uid;
+	uint8_t i;
+
+	for (i = p->count; i-- > 0;)
+	{
+		tag = &p->tags[i];
+		uid = find_seen(seen, count, &tag->uid);
+		if (uid != NULL)
+		{
+			tag->uid = *uid;
+			tag->hits++;
+			tag->misses = 0;
+			tag->lastSeen = now;
+			if (tag->state == PRESENCE_GONE || tag->hits >= p->presentAfter)
+				tag->state = PRESENCE_PRESENT;
+			continue;
+		}
+
+		tag->hits = 0;
+		if (tag->state == PRESENCE_CANDIDATE)
+		{
+			presence_remove(p, i);
+		}
+		else if (tag->state == PRESENCE_PRESENT && ++tag->misses >= p->absentAfter && now - tag->lastSeen >= p->absentTime)
+		{
+			if (tag->reported)
+				tag->state = PRESENCE_GONE;
+			else
+				presence_remove(p, i);
+		}
+	}
+
+	// Tags seen for the first time, as long as there is room
+	for (i = 0; i < count && p->count < PRESENCE_MAX; i++)
+	{
+		if (is_tracked(p, &seen[i]))
+			continue;
+		tag = &p->tags[p->count++];
+		tag->uid = seen[i];
+		tag->state = p->presentAfter <= 1 ? PRESENCE_PRESENT : PRESENCE_CANDIDATE;
+		tag->reported = 0;
+		tag->hits = 1;
+		tag->misses = 0;
+		tag->firstSeen = now;
+		tag->lastSeen = now;
+	}
+}
@@ -0,0 +1,55 @@
+/*
+ * presence.h
+ *
+ *  Debounces the tags a reader sees. A tag is only present once it was seen
+ *  in presentAfter cycles in a row, and only absent once it was missed in
+ *  absentAfter cycles in a row and for absentTime, so a tag at the edge of
+ *  the field doesn't flap between present and absent.
+ */
+
+#ifndef PRESENCE_H_
+#define PRESENCE_H_
+
+#include <stdint.h>
+#include "rfid.h"
+
+#define PRESENCE_MAX INVENTORY_MAX_TAGS
+
+#define PRESENCE_CANDIDATE 0	// seen, but not in presentAfter cycles yet
+#define PRESENCE_PRESENT 1
+#define PRESENCE_GONE 2			// absent, left to report
+
+typedef struct presence_tag
+{
+	// ATQA and SAK of the last sighting
+	rfid_uid uid;
+	uint8_t state;
+	// Reported as present, set by the caller
+	uint8_t reported;
+	uint32_t hits;
+	uint32_t misses;
+	// CLOCK_MONOTONIC ns of the first and the last sighting
+	uint64_t firstSeen;
+	uint64_t lastSeen;
+} presence_tag;
+
+typedef struct presence
+{
+	uint32_t presentAfter;
+	uint32_t absentAfter;
+	uint64_t absentTime;	// ns
+	presence_tag tags[PRESENCE_MAX];
+	uint8_t count;
+} presence;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    void presence_init(presence *p, uint32_t presentAfter, uint32_t absentAfter, uint64_t absentTime);
+    void presence_update(presence *p, const rfid_uid *seen, uint8_t count, uint64_t now);
+    void presence_remove(presence *p, uint8_t index);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PRESENCE_H_ */
@@ -1,28 +1,110 @@
 
 #include <string.h>
 #include <stdio.h>
-#include <unistd.h>
-#include "bcm2835.h"
 #include "rc522.h"
 
 uint8_t debug = 0;
+static rc522_dev *dev;
+
+// Registers that only change when written by the driver. Their value is
+// kept in rc522_dev.shadow, so SetBitMask/ClearBitMask need no SPI read.
+// IRQ, error, status, FIFO, CommandReg, ControlReg and CollReg are
+// volatile and always read from the chip.
+#define SHADOW_REG(r)         (1ULL<<(r))
+#define SHADOW_REGS           (SHADOW_REG(ComIEnReg)|SHADOW_REG(DivlEnReg)|SHADOW_REG(WaterLevelReg)| \
+                               SHADOW_REG(BitFramingReg)|SHADOW_REG(ModeReg)|SHADOW_REG(TxModeReg)| \
+                               SHADOW_REG(RxModeReg)|SHADOW_REG(TxControlReg)|SHADOW_REG(TxASKReg)| \
+                               SHADOW_REG(TxSelReg)|SHADOW_REG(RxSelReg)|SHADOW_REG(RxThresholdReg)| \
+                               SHADOW_REG(DemodReg)|SHADOW_REG(MifareReg)|SHADOW_REG(ModWidthReg)| \
+                               SHADOW_REG(RFCfgReg)|SHADOW_REG(GsNReg)|SHADOW_REG(CWGsCfgReg)| \
+                               SHADOW_REG(ModGsCfgReg)|SHADOW_REG(TModeReg)|SHADOW_REG(TPrescalerReg)| \
+                               SHADOW_REG(TReloadRegH)|SHADOW_REG(TReloadRegL))
+
+void Rc522Select(rc522_dev *d)
+{
+	dev = d;
+}
+
+// CRC_A (ISO14443-3, x^16+x^12+x^5+1 reflected, preset 0x6363), one
+// table lookup per byte
+static const uint16_t crcTable[256] = {
+	0x0000, 0x1189, 0x2312, 0x329B, 0x4624, 0x57AD, 0x6536, 0x74BF,
+	0x8C48, 0x9DC1, 0xAF5A, 0xBED3, 0xCA6C, 0xDBE5, 0xE97E, 0xF8F7,
+	0x1081, 0x0108, 0x3393, 0x221A, 0x56A5, 0x472C, 0x75B7, 0x643E,
+	0x9CC9, 0x8D40, 0xBFDB, 0xAE52, 0xDAED, 0xCB64, 0xF9FF, 0xE876,
+	0x2102, 0x308B, 0x0210, 0x1399, 0x6726, 0x76AF, 0x4434, 0x55BD,
+	0xAD4A, 0xBCC3, 0x8E58, 0x9FD1, 0xEB6E, 0xFAE7, 0xC87C, 0xD9F5,
+	0x3183, 0x200A, 0x1291, 0x0318, 0x77A7, 0x662E, 0x54B5, 0x453C,
+	0xBDCB, 0xAC42, 0x9ED9, 0x8F50, 0xFBEF, 0xEA66, 0xD8FD, 0xC974,
+	0x4204, 0x538D, 0x6116, 0x709F, 0x0420, 0x15A9, 0x2732, 0x36BB,
+	0xCE4C, 0xDFC5, 0xED5E, 0xFCD7, 0x8868, 0x99E1, 0xAB7A, 0xBAF3,
+	0x5285, 0x430C, 0x7197, 0x601E, 0x14A1, 0x0528, 0x37B3, 0x263A,
+	0xDECD, 0xCF44, 0xFDDF, 0xEC56, 0x98E9, 0x8960, 0xBBFB, 0xAA72,
+	0x6306, 0x728F, 0x4014, 0x519D, 0x2522, 0x34AB, 0x0630, 0x17B9,
+	0xEF4E, 0xFEC7, 0xCC5C, 0xDDD5, 0xA96A, 0xB8E3, 0x8A78, 0x9BF1,
+	0x7387, 0x620E, 0x5095, 0x411C, 0x35A3, 0x242A, 0x16B1, 0x0738,
+	0xFFCF, 0xEE46, 0xDCDD, 0xCD54, 0xB9EB, 0xA862, 0x9AF9, 0x8B70,
+	0x8408, 0x9581, 0xA71A, 0xB693, 0xC22C, 0xD3A5, 0xE13E, 0xF0B7,
+	0x0840, 0x19C9, 0x2B52, 0x3ADB, 0x4E64, 0x5FED, 0x6D76, 0x7CFF,
+	0x9489, 0x8500, 0xB79B, 0xA612, 0xD2AD, 0xC324, 0xF1BF, 0xE036,
+	0x18C1, 0x0948, 0x3BD3, 0x2A5A, 0x5EE5, 0x4F6C, 0x7DF7, 0x6C7E,
+	0xA50A, 0xB483, 0x8618, 0x9791, 0xE32E, 0xF2A7, 0xC03C, 0xD1B5,
+	0x2942, 0x38CB, 0x0A50, 0x1BD9, 0x6F66, 0x7EEF, 0x4C74, 0x5DFD,
+	0xB58B, 0xA402, 0x9699, 0x8710, 0xF3AF, 0xE226, 0xD0BD, 0xC134,
+	0x39C3, 0x284A, 0x1AD1, 0x0B58, 0x7FE7, 0x6E6E, 0x5CF5, 0x4D7C,
+	0xC60C, 0xD785, 0xE51E, 0xF497, 0x8028, 0x91A1, 0xA33A, 0xB2B3,
+	0x4A44, 0x5BCD, 0x6956, 0x78DF, 0x0C60, 0x1DE9, 0x2F72, 0x3EFB,
+	0xD68D, 0xC704, 0xF59F, 0xE416, 0x90A9, 0x8120, 0xB3BB, 0xA232,
+	0x5AC5, 0x4B4C, 0x79D7, 0x685E, 0x1CE1, 0x0D68, 0x3FF3, 0x2E7A,
+	0xE70E, 0xF687, 0xC41C, 0xD595, 0xA12A, 0xB0A3, 0x8238, 0x93B1,
+	0x6B46, 0x7ACF, 0x4854, 0x59DD, 0x2D62, 0x3CEB, 0x0E70, 0x1FF9,
+	0xF78F, 0xE606, 0xD49D, 0xC514, 0xB1AB, 0xA022, 0x92B9, 0x8330,
+	0x7BC7, 0x6A4E, 0x58D5, 0x495C, 0x3DE3, 0x2C6A, 0x1EF1, 0x0F78,
+};
+
+static uint8_t ReadShadowRC(uint8_t Address);
+static void ShadowWrite(uint8_t Address, uint8_t value);
+static void PcdSetCRC(uint8_t tx, uint8_t rx);
+static uint8_t PcdFrameCRC(uint8_t *pBuf, uint8_t len, uint8_t rxCRC);
+
+static void Rc522Delay(uint32_t us)
+{
+	dev->transport->delay_us(dev->transport->ctx, us);
+}
 
 void InitRc522(void)
 {
 	PcdReset();
 	PcdAntennaOn();
+	// push-pull IRQ output, only used if the pin is wired
+	WriteRawRC(DivlEnReg,dev->irq ? 0x80 : 0x00);
+	dev->version = ReadRawRC(VersionReg);
 }
 
 char PcdRequest(uint8_t req_code,uint8_t *pTagType)
+{
+	PcdRequestStart(req_code);
+	return PcdRequestFinish(pTagType,PcdComMF522Wait());
+}
+
+// Send REQA/WUPA without waiting for the ATQA, see PcdComMF522Start. Runs
+// with the short receive timeout of PCD_TMODE_PROBE, so polling an empty
+// field is cheap.
+void PcdRequestStart(uint8_t req_code)
+{
+	PcdSetCRC(0,0);
+	WriteRawRC(BitFramingReg,0x07);
+	dev->probe = 1;
+	PcdComMF522Start(PCD_TRANSCEIVE,&req_code,1);
+}
+
+char PcdRequestFinish(uint8_t *pTagType,uint8_t done)
 {
 	char   status;
 	uint8_t   unLen;
 	uint8_t   ucComMF522Buf[MAXRLEN];
 
-	WriteRawRC(BitFramingReg,0x07);
-	ucComMF522Buf[0] = req_code;
-
-	status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,1,ucComMF522Buf,&unLen);
+	status = PcdComMF522Finish(ucComMF522Buf,&unLen,done);
 	if ((status == TAG_OK) && (unLen == 0x10))
 	{
 		*pTagType     = ucComMF522Buf[0];
@@ -38,45 +120,77 @@ char PcdRequest(uint8_t req_code,uint8_t *pTagType)
 	return status;
 }
 
+// Bit oriented anticollision (ISO14443-3 6.5.3.2). The UID bits known so far
+// are sent along with the SELECT, only tags matching them answer with the
+// rest of their UID. At the first collided bit the 1 branch is taken and the
+// loop restarts with that bit known, so each collided bit costs one round.
 char PcdAnticoll(uint8_t cascade, uint8_t *pSnr)
 {
-	char   status;
+	char   status = TAG_ERR;
 	uint8_t   i,snr_check=0;
 	uint8_t   unLen;
 	uint8_t   ucComMF522Buf[MAXRLEN];
-	uint8_t   pass=32;
-	uint8_t	  collbits=0;
+	uint8_t   cln[5] = {0};		// UID CLn and BCC
+	uint8_t   known = 0;		// bits of cln already resolved
+	uint8_t   align,bytes,end;
+	uint8_t   coll = 0,pos = 0;	// CollReg and the collided bit of the last round
 
-	i=0;
-	WriteRawRC(BitFramingReg,0x00);
-	do {
+	PcdSetCRC(0,0);
+	while (known < 40)
+	{
+		align = known % 8;
+		bytes = known / 8;
 		ucComMF522Buf[0] = cascade;
-		ucComMF522Buf[1] = 0x20+collbits;
-		//	WriteRawRC(0x0e,0);
-		status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,2+i,ucComMF522Buf,&unLen);
-		if (status == TAG_COLLISION) {
-			collbits=ReadRawRC(CollReg)&0x1f;
-			if (collbits==0) collbits=32;
-			i=(collbits-1)/8 +1;
-//			printf ("--- %02x %02x %02x %02x %d\n",ucComMF522Buf[0],ucComMF522Buf[1],ucComMF522Buf[2],ucComMF522Buf[3],unLen);
-			ucComMF522Buf[i-1]|=(1<<((collbits-1)%8));
-			ucComMF522Buf[5]=ucComMF522Buf[3];
-			ucComMF522Buf[4]=ucComMF522Buf[2];
-			ucComMF522Buf[3]=ucComMF522Buf[1];
-			ucComMF522Buf[2]=ucComMF522Buf[0];
-			WriteRawRC(BitFramingReg,(collbits % 8));
-//			printf (" %d %d %02x %d\n",collbits,i,ucComMF522Buf[i+1],collbits % 8);
+		ucComMF522Buf[1] = ((2+bytes)<<4) | align;	// NVB
+		memcpy(&ucComMF522Buf[2],cln,bytes+(align ? 1 : 0));
+		// The partial byte is sent with TxLastBits and the answer continues
+		// it at RxAlign, so FIFO byte 0 lines up with cln[bytes]
+		WriteRawRC(BitFramingReg,(align<<4) | align);
+
+		status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,2+bytes+(align ? 1 : 0),ucComMF522Buf,&unLen);
+		if (status != TAG_OK && status != TAG_COLLISION) {break;}
+
+		end = bytes*8 + unLen;
+		if (status == TAG_COLLISION)
+		{
+			coll = ReadRawRC(CollReg);
+			if (coll & 0x20) {
+				// CollPosNotValid: the first collision lies beyond CollPos' range
+				pos = bytes*8 + 32;
+			}
+			else {
+				pos = bytes*8 + ((coll & 0x1F) ? (coll & 0x1F) : 32) - 1;
+			}
+			if (pos < known || pos >= 40 || pos > end) {status = TAG_ERR; break;}
+			end = pos;
 		}
-	} while (((--pass)>0)&&(status==TAG_COLLISION));
+		else if (end != 40) {status = TAG_ERR; break;}
+
+		for (i=known; i<end; i++)
+		{
+			if (ucComMF522Buf[(i-bytes*8)/8] & (1<<((i-bytes*8)%8))) {cln[i/8] |= 1<<(i%8);}
+			else {cln[i/8] &= ~(1<<(i%8));}
+		}
+		known = end;
+
+		if (status == TAG_OK) {break;}
+		if (!(coll & 0x20))
+		{
+			cln[pos/8] |= 1<<(pos%8);
+			known = pos+1;
+		}
+		status = TAG_ERR;
+	}
+	WriteRawRC(BitFramingReg,0x00);
 
 	if (status == TAG_OK)
 	{
 		for (i=0; i<4; i++)
 		{
-			*(pSnr+i)  = ucComMF522Buf[i];
-			snr_check ^= ucComMF522Buf[i];
+			*(pSnr+i)  = cln[i];
+			snr_check ^= cln[i];
 		}
-		if (snr_check != ucComMF522Buf[i])
+		if (snr_check != cln[i])
 		{   status = TAG_ERR;    }
 	}
 
@@ -86,7 +200,7 @@ char PcdAnticoll(uint8_t cascade, uint8_t *pSnr)
 char PcdSelect(uint8_t cascade, uint8_t *pSnr)
 {
 	char   status;
-	uint8_t   i;
+	uint8_t   i,len;
 	uint8_t   unLen;
 	uint8_t   ucComMF522Buf[MAXRLEN];
 
@@ -98,14 +212,16 @@ char PcdSelect(uint8_t cascade, uint8_t *pSnr)
 		ucComMF522Buf[i+2] = *(pSnr+i);
 		ucComMF522Buf[6]  ^= *(pSnr+i);
 	}
-	CalulateCRC(ucComMF522Buf,7,&ucComMF522Buf[7]);
+	len = PcdFrameCRC(ucComMF522Buf,7,1);
 
-	ClearBitMask(Status2Reg,0x08);
+	// MFCrypto1On is the only writable bit the driver uses, the rest is read only
+	WriteRawRC(Status2Reg,0x00);
 
-	status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,9,ucComMF522Buf,&unLen);
+	status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,len,ucComMF522Buf,&unLen);
 
-	if ((status == TAG_OK) && (unLen == 0x18))
-	{   status = TAG_OK;  }
+	// SAK, followed by its CRC unless the chip checked and removed it
+	if ((status == TAG_OK) && (unLen == (dev->crcOffload ? 0x08 : 0x18)))
+	{   status = TAG_OK;  dev->sak = ucComMF522Buf[0];  }
 	else
 	{   status = TAG_ERR;    }
 
@@ -124,7 +240,9 @@ char PcdAuthState(uint8_t   auth_mode,uint8_t   addr,uint8_t *pKey,uint8_t *pSnr
 	memcpy(&ucComMF522Buf[8], pSnr, 4);
 
 	status = PcdComMF522(PCD_AUTHENT,ucComMF522Buf,12,ucComMF522Buf,&unLen);
-	if ((status != TAG_OK) || (!(ReadRawRC(Status2Reg) & 0x08)))
+	// Without IdleIRq the timer ended a failed authentication; MFCrypto1On
+	// may still be set from the sector authenticated before
+	if ((status != TAG_OK) || (!(dev->comIrq & 0x10)) || (!(ReadRawRC(Status2Reg) & 0x08)))
 	{   status = TAG_ERR;   }
 
 	return status;
@@ -133,21 +251,27 @@ char PcdAuthState(uint8_t   auth_mode,uint8_t   addr,uint8_t *pKey,uint8_t *pSnr
 char PcdRead(uint8_t addr,uint8_t *p )
 {
 	char   status;
-	uint8_t   unLen;
+	uint8_t   unLen,len;
 	uint8_t   i,ucComMF522Buf[MAXRLEN];
 	uint8_t   CRC_buff[2];
 
 	memset(ucComMF522Buf,0,sizeof(ucComMF522Buf));
 	ucComMF522Buf[0] = PICC_READ;
 	ucComMF522Buf[1] = addr;
-	CalulateCRC(ucComMF522Buf,2,&ucComMF522Buf[2]);
+	len = PcdFrameCRC(ucComMF522Buf,2,1);
+	dev->expectRx = 18;
 
-	status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,4,ucComMF522Buf,&unLen);
-	CalulateCRC(ucComMF522Buf,16,CRC_buff);
-	//	printf("debug %02x%02x %02x%02x   ",ucComMF522Buf[16],ucComMF522Buf[17],CRC_buff[0],CRC_buff[1]);
+	status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,len,ucComMF522Buf,&unLen);
 
-	if ((status == TAG_OK) && (unLen == 0x90))
+	if (dev->crcOffload && (status == TAG_OK || status == TAG_ERRCRC) && (unLen == 0x80))
+	{
+		for (i=0; i<16; i++)
+		{    *(p +i) = ucComMF522Buf[i];   }
+	}
+	else if ((status == TAG_OK) && (unLen == 0x90))
 	{
+		CalulateCRC(ucComMF522Buf,16,CRC_buff);
+		//	printf("debug %02x%02x %02x%02x   ",ucComMF522Buf[16],ucComMF522Buf[17],CRC_buff[0],CRC_buff[1]);
 		if ((CRC_buff[0]!=ucComMF522Buf[16])||(CRC_buff[1]!=ucComMF522Buf[17])) { status = TAG_ERRCRC; }
 		for (i=0; i<16; i++)
 		{    *(p +i) = ucComMF522Buf[i];   }
@@ -158,20 +282,32 @@ char PcdRead(uint8_t addr,uint8_t *p )
 	return status;
 }
 
+// The tag answers each half of a write with a 4 bit ACK (0xA). A NAK of 0x0
+// or 0x4 refuses the operation, e.g. by the access conditions, and is
+// reported as TAG_NAK; 0x1 and 0x5 are transmission errors.
+static char PcdWriteAck(char status, uint8_t unLen, uint8_t ack)
+{
+	if ((status != TAG_OK) || (unLen != 4))
+	{   return TAG_ERR;   }
+	if ((ack & 0x0F) == 0x0A)
+	{   return TAG_OK;   }
+	if (((ack & 0x0F) == 0x00) || ((ack & 0x0F) == 0x04))
+	{   return TAG_NAK;   }
+	return TAG_ERR;
+}
+
 char PcdWrite(uint8_t   addr,uint8_t *p )
 {
 	char   status;
-	uint8_t   unLen;
+	uint8_t   unLen,len;
 	uint8_t   i,ucComMF522Buf[MAXRLEN];
 
 	ucComMF522Buf[0] = PICC_WRITE;
 	ucComMF522Buf[1] = addr;
-	CalulateCRC(ucComMF522Buf,2,&ucComMF522Buf[2]);
+	len = PcdFrameCRC(ucComMF522Buf,2,0);
 
-	status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,4,ucComMF522Buf,&unLen);
-
-	if ((status != TAG_OK) || (unLen != 4) || ((ucComMF522Buf[0] & 0x0F) != 0x0A))
-	{   status = TAG_ERR;   }
+	status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,len,ucComMF522Buf,&unLen);
+	status = PcdWriteAck(status,unLen,ucComMF522Buf[0]);
 
 	if (status == TAG_OK)
 	{
@@ -179,11 +315,10 @@ char PcdWrite(uint8_t   addr,uint8_t *p )
 		{
 			ucComMF522Buf[i] = *(p +i);
 		}
-		CalulateCRC(ucComMF522Buf,16,&ucComMF522Buf[16]);
+		len = PcdFrameCRC(ucComMF522Buf,16,0);
 
-		status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,18,ucComMF522Buf,&unLen);
-		if ((status != TAG_OK) || (unLen != 4) || ((ucComMF522Buf[0] & 0x0F) != 0x0A))
-		{   status = TAG_ERR;   }
+		status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,len,ucComMF522Buf,&unLen);
+		status = PcdWriteAck(status,unLen,ucComMF522Buf[0]);
 	}
 
 	return status;
@@ -192,57 +327,212 @@ char PcdWrite(uint8_t   addr,uint8_t *p )
 char PcdHalt(void)
 {
 	uint8_t status;
-	uint8_t unLen;
+	uint8_t unLen,len;
 	uint8_t ucComMF522Buf[MAXRLEN];
 
 	ucComMF522Buf[0] = PICC_HALT;
 	ucComMF522Buf[1] = 0;
-	CalulateCRC(ucComMF522Buf,2,&ucComMF522Buf[2]);
+	len = PcdFrameCRC(ucComMF522Buf,2,0);
 
-	status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,4,ucComMF522Buf,&unLen);
+	// A halted tag does not answer, a NAK would arrive within 1ms.
+	// Don't wait for the full receive timeout.
+	WriteRawRC(TReloadRegL,2);
+	status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,len,ucComMF522Buf,&unLen);
+	WriteRawRC(TReloadRegL,30);
 
 	return status;
 }
 
-void CalulateCRC(uint8_t *pIn ,uint8_t   len,uint8_t *pOut )
+// Transceive whose answer may be longer than the FIFO. Whenever HiAlertIRq
+// reports the FIFO filled up to PCD_WATER_LEVEL it is drained into pOut, so
+// answers of up to maxOut bytes plus CRC are received into pOut, which needs
+// room for the CRC too; *pOutLen is their length in bytes without the CRC.
+char PcdTransceiveLong(uint8_t *pIn, uint8_t InLenByte, uint8_t *pOut, uint16_t maxOut, uint16_t *pOutLen)
 {
-	uint8_t   i,n;
-	ClearBitMask(DivIrqReg,0x04);
-	WriteRawRC(CommandReg,PCD_IDLE);
-	SetBitMask(FIFOLevelReg,0x80);
+	char   status = TAG_ERR;
+	uint8_t   PcdErr, level, irq, done = 0;
+	uint8_t   CRC_buff[2];
+	uint16_t   n = 0;
+	uint32_t   i;
+
+	if (ReadShadowRC(WaterLevelReg) != PCD_WATER_LEVEL)
+	{   WriteRawRC(WaterLevelReg,PCD_WATER_LEVEL);   }
+	dev->expectRx = 0;
+	PcdComMF522Start(PCD_TRANSCEIVE,pIn,InLenByte);
+	if (dev->irq)
+	{   WriteRawRC(ComIEnReg,ReadShadowRC(ComIEnReg)|0x08);   }
+	Rc522Delay(dev->waitUs);
+
+	// The answer streams in at PCD_BYTE_US a byte, it may take as long as
+	// maxOut bytes on top of the receive timeout
+	for (i = (maxOut+2)*PCD_BYTE_US/200 + 150; i > 0; i--)
+	{
+		irq = ReadRawRC(ComIrqReg);
+		if (irq & 0x08)
+		{
+			// Cleared first, bytes arriving meanwhile raise it again
+			WriteRawRC(ComIrqReg,0x08);
+			level = ReadRawRC(FIFOLevelReg) & 0x7F;
+			if (n + level > maxOut + 2) {break;}
+			ReadRawRCBurst(FIFODataReg,pOut+n,level);
+			n += level;
+		}
+		dev->comIrq = irq;
+		if ((irq & 0x01) || (irq & dev->waitFor)) {done = 1; break;}
+		if (dev->irq) {dev->transport->wait_irq(dev->transport->ctx,200);}
+		else {Rc522Delay(200);}
+	}
+	WriteRawRC(BitFramingReg,ReadShadowRC(BitFramingReg)&~0x80);
+	if (!done)
+	{   return TAG_ERR;   }
+
+	PcdErr = ReadRawRC(ErrorReg);
+	level = ReadRawRC(FIFOLevelReg) & 0x7F;
+	if (PcdErr & 0x08) {return TAG_COLLISION;}
+	if (PcdErr & 0x11) {return TAG_ERR;}
+	if (dev->comIrq & dev->irqEn & 0x01) {return TAG_NOTAG;}
+	if (n + level > maxOut + 2) {return TAG_ERR;}
+	ReadRawRCBurst(FIFODataReg,pOut+n,level);
+	n += level;
+
+	status = (PcdErr & 0x04) ? TAG_ERRCRC : TAG_OK;
+	if (!dev->crcOffload && status == TAG_OK)
+	{
+		if (n < 2) {return TAG_ERR;}
+		n -= 2;
+		CalulateCRC(pOut,n,CRC_buff);
+		if ((CRC_buff[0]!=pOut[n])||(CRC_buff[1]!=pOut[n+1])) {status = TAG_ERRCRC;}
+	}
+	*pOutLen = n;
+	return status;
+}
+
+// GET_VERSION of Ultralight EV1 and NTAG21x, 8 bytes. Older tags don't know
+// it and go back to IDLE.
+char PcdGetVersion(uint8_t *pVersion)
+{
+	char   status;
+	uint8_t   unLen,len;
+	uint8_t   ucComMF522Buf[MAXRLEN];
+	uint8_t   CRC_buff[2];
+
+	ucComMF522Buf[0] = PICC_GET_VERSION;
+	len = PcdFrameCRC(ucComMF522Buf,1,1);
+	dev->expectRx = 10;
+
+	status = PcdComMF522(PCD_TRANSCEIVE,ucComMF522Buf,len,ucComMF522Buf,&unLen);
+	if (dev->crcOffload && status == TAG_OK && unLen == 0x40)
+	{   memcpy(pVersion,ucComMF522Buf,8);   }
+	else if (!dev->crcOffload && status == TAG_OK && unLen == 0x50)
+	{
+		CalulateCRC(ucComMF522Buf,8,CRC_buff);
+		if ((CRC_buff[0]!=ucComMF522Buf[8])||(CRC_buff[1]!=ucComMF522Buf[9])) { status = TAG_ERRCRC; }
+		memcpy(pVersion,ucComMF522Buf,8);
+	}
+	else if (status == TAG_OK)
+	{   status = TAG_ERR;   }
+
+	return status;
+}
+
+// FAST_READ of the pages start to end into pData, in a single frame; pData
+// needs 2 bytes more room for the CRC
+char PcdFastRead(uint8_t start, uint8_t end, uint8_t *pData)
+{
+	char   status;
+	uint8_t   ucComMF522Buf[MAXRLEN];
+	uint16_t   size = (end - start + 1) * 4, unLen = 0;
+
+	ucComMF522Buf[0] = PICC_FAST_READ;
+	ucComMF522Buf[1] = start;
+	ucComMF522Buf[2] = end;
+
+	status = PcdTransceiveLong(ucComMF522Buf,PcdFrameCRC(ucComMF522Buf,3,1),pData,size,&unLen);
+	if (status == TAG_OK && unLen != size)
+	{   status = TAG_ERR;   }
+	return status;
+}
+
+// Computed on the host, the chip's CRC coprocessor would cost a FIFO load
+// and several SPI round-trips per call
+void CalulateCRC(uint8_t *pIn ,uint16_t   len,uint8_t *pOut )
+{
+	uint16_t crc = 0x6363;
+	uint16_t   i;
 	for (i=0; i<len; i++)
-	{   WriteRawRC(FIFODataReg, *(pIn +i));   }
-	WriteRawRC(CommandReg, PCD_CALCCRC);
-	i = 0xFF;
-	do
+	{   crc = (crc >> 8) ^ crcTable[(crc ^ pIn[i]) & 0xFF];   }
+	pOut [0] = crc & 0xFF;
+	pOut [1] = crc >> 8;
+}
+
+// With crcOffload the chip appends (TxModeReg) and checks (RxModeReg) the
+// CRC itself. Frames without CRC (REQA, anticollision, ACK/NAK) need it off.
+static void PcdSetCRC(uint8_t tx, uint8_t rx)
+{
+	uint8_t   value;
+
+	if (!dev->crcOffload)
+	{   return;   }
+
+	value = ReadShadowRC(TxModeReg);
+	if (!(value & 0x80) != !tx)
+	{   WriteRawRC(TxModeReg, tx ? (value | 0x80) : (value & ~0x80));   }
+	value = ReadShadowRC(RxModeReg);
+	if (!(value & 0x80) != !rx)
+	{   WriteRawRC(RxModeReg, rx ? (value | 0x80) : (value & ~0x80));   }
+}
+
+// Appends the CRC to a frame of len bytes unless the chip does it.
+// Returns the number of bytes to send.
+static uint8_t PcdFrameCRC(uint8_t *pBuf, uint8_t len, uint8_t rxCRC)
+{
+	if (dev->crcOffload)
 	{
-		n = ReadRawRC(DivIrqReg);
-		i--;
+		PcdSetCRC(1, rxCRC);
+		return len;
 	}
-	while ((i!=0) && !(n&0x04));
-	pOut [0] = ReadRawRC(CRCResultRegL);
-	pOut [1] = ReadRawRC(CRCResultRegM);
+	CalulateCRC(pBuf,len,&pBuf[len]);
+	return len+2;
 }
 
 char PcdReset(void)
 {
+	rc522_batch batch;
+
 	WriteRawRC(CommandReg,PCD_RESETPHASE);
-	usleep(10000);
+	Rc522Delay(10000);
 	ClearBitMask(TxControlReg,0x03);
-	usleep(10000);
+	Rc522Delay(10000);
 	SetBitMask(TxControlReg,0x03);
-	WriteRawRC(TModeReg,0x8D);
-	WriteRawRC(TPrescalerReg,0x3E);
-	WriteRawRC(TReloadRegL,30);
-	WriteRawRC(TReloadRegH,0);
-	WriteRawRC(TxASKReg,0x40);
-	WriteRawRC(ModeReg,0x3D);            //6363
+	PcdBatchBegin(&batch);
+	PcdBatchWrite(&batch,TModeReg,PCD_TMODE);
+	PcdBatchWrite(&batch,TPrescalerReg,0x3E);
+	PcdBatchWrite(&batch,TReloadRegL,30);
+	PcdBatchWrite(&batch,TReloadRegH,0);
+	PcdBatchWrite(&batch,TxASKReg,0x40);
+	PcdBatchWrite(&batch,ModeReg,0x3D);            //6363
 	//	WriteRawRC(DivlEnReg,0x90);
-	WriteRawRC(RxThresholdReg,0x84);
-	WriteRawRC(RFCfgReg,0x68);
-	WriteRawRC(GsNReg,0xff);
-	WriteRawRC(CWGsCfgReg,0x2f);
+	PcdBatchWrite(&batch,RxThresholdReg,0x84);
+	PcdBatchWrite(&batch,RFCfgReg,0x68);
+	PcdBatchWrite(&batch,GsNReg,0xff);
+	PcdBatchWrite(&batch,CWGsCfgReg,0x2f);
 	//	WriteRawRC(ModWidthReg,0x2f);
+	PcdBatchSubmit(&batch);
+
+	return TAG_OK;
+}
+
+// Cheap check that the chip is still alive and configured, i.e. it has not
+// been power cycled or reset since InitRc522.
+char PcdCheck(void)
+{
+	uint8_t   value;
+
+	if (dev->version == 0x00 || dev->version == 0xFF || ReadRawRC(VersionReg) != dev->version)
+	{   return TAG_ERR;   }
+	value = ReadRawRC(TModeReg);
+	if (value != PCD_TMODE && value != PCD_TMODE_PROBE)
+	{   return TAG_ERR;   }
 
 	return TAG_OK;
 }
@@ -252,7 +542,7 @@ char M500PcdConfigISOType(uint8_t   type)
 {
 	if (type == 'A')
 	{
-		ClearBitMask(Status2Reg,0x08);
+		WriteRawRC(Status2Reg,0x00);
 		WriteRawRC(ModeReg,0x3D);
 		WriteRawRC(RxSelReg,0x86);
 		WriteRawRC(RFCfgReg,0x7F);
@@ -268,50 +558,215 @@ char M500PcdConfigISOType(uint8_t   type)
 }
  */
 
+static void ShadowWrite(uint8_t Address, uint8_t value)
+{
+	if (SHADOW_REGS & SHADOW_REG(Address))
+	{
+		dev->shadow[Address] = value;
+		dev->shadowValid |= SHADOW_REG(Address);
+	}
+	else if (Address == CommandReg && (value & 0x0F) == PCD_RESETPHASE)
+	{
+		// soft reset restores the reset values
+		dev->shadowValid = 0;
+	}
+}
+
 uint8_t ReadRawRC(uint8_t Address)
 {
-	char buff[2];
+	uint8_t buff[2];
 	buff[0] = ((Address<<1)&0x7E)|0x80;
-	bcm2835_spi_transfern(buff,2);
-	return (uint8_t)buff[1];
+	buff[1] = 0;
+	dev->transport->transfer(dev->transport->ctx,buff,2);
+	if (SHADOW_REGS & SHADOW_REG(Address))
+	{
+		dev->shadow[Address] = buff[1];
+		dev->shadowValid |= SHADOW_REG(Address);
+	}
+	return buff[1];
 }
 
 void WriteRawRC(uint8_t Address, uint8_t value)
 {
-	char buff[2];
+	uint8_t buff[2];
+
+	buff[0] = (uint8_t)((Address<<1)&0x7E);
+	buff[1] = value;
+	dev->transport->transfer(dev->transport->ctx,buff,2);
+	ShadowWrite(Address,value);
+}
+
+// Value of a register, from the shadow copy if it is a known configuration register
+static uint8_t ReadShadowRC(uint8_t Address)
+{
+	if (dev->shadowValid & SHADOW_REG(Address))
+	{   return dev->shadow[Address];   }
+	return ReadRawRC(Address);
+}
+
+// Writes len bytes to the same register (e.g. FIFODataReg) in one SPI frame
+void WriteRawRCBurst(uint8_t Address, const uint8_t *pData, uint8_t len)
+{
+	uint8_t buff[DEF_FIFO_LENGTH+1];
+	uint8_t n;
+
+	while (len > 0)
+	{
+		n = len > DEF_FIFO_LENGTH ? DEF_FIFO_LENGTH : len;
+		buff[0] = (uint8_t)((Address<<1)&0x7E);
+		memcpy(&buff[1],pData,n);
+		dev->transport->transfer(dev->transport->ctx,buff,n+1);
+		pData += n;
+		len -= n;
+	}
+}
+
+// Reads the same register len times in one SPI frame, every byte sent
+// addresses the register again and the last one terminates the read
+void ReadRawRCBurst(uint8_t Address, uint8_t *pData, uint8_t len)
+{
+	uint8_t buff[DEF_FIFO_LENGTH+1];
+	uint8_t n;
+
+	while (len > 0)
+	{
+		n = len > DEF_FIFO_LENGTH ? DEF_FIFO_LENGTH : len;
+		memset(buff,((Address<<1)&0x7E)|0x80,n);
+		buff[n] = 0;
+		dev->transport->transfer(dev->transport->ctx,buff,n+1);
+		memcpy(pData,&buff[1],n);
+		pData += n;
+		len -= n;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////
+// Batched register access
+//
+// Queued accesses are compiled into as few SPI frames as the chip allows:
+// consecutive reads share one frame (every byte addresses the next
+// register), consecutive writes to the same register form a burst, and
+// everything is handed to the transport in a single call.
+/////////////////////////////////////////////////////////////////////
 
-	buff[0] = (char)((Address<<1)&0x7E);
-	buff[1] = (char)value;
-	bcm2835_spi_transfern(buff,2);
+void PcdBatchBegin(rc522_batch *b)
+{
+	b->len = 0;
+	b->segments = 0;
+	b->reads = 0;
+	b->lastIsRead = 0;
+}
+
+void PcdBatchSubmit(rc522_batch *b)
+{
+	uint32_t off = 0;
+	uint8_t   i;
+
+	if (b->segments == 0)
+	{   return;   }
+
+	if (dev->transport->transfer_segments)
+	{
+		dev->transport->transfer_segments(dev->transport->ctx,b->buf,b->segLen,b->segments);
+	}
+	else
+	{
+		for (i=0; i<b->segments; i++)
+		{
+			dev->transport->transfer(dev->transport->ctx,b->buf+off,b->segLen[i]);
+			off += b->segLen[i];
+		}
+	}
+
+	for (i=0; i<b->reads; i++)
+	{   *b->readOut[i] = b->buf[b->readPos[i]];   }
+
+	PcdBatchBegin(b);
+}
+
+void PcdBatchWriteBurst(rc522_batch *b, uint8_t Address, const uint8_t *pData, uint8_t len)
+{
+	uint32_t n;
+
+	if (len == 0)
+	{   return;   }
+	ShadowWrite(Address,pData[len-1]);
+
+	while (len > 0)
+	{
+		if (b->segments == 0 || b->lastIsRead || b->lastReg != Address || b->len == BATCH_MAX_BYTES)
+		{
+			if (b->segments == BATCH_MAX_SEGMENTS || b->len + 2 > BATCH_MAX_BYTES)
+			{   PcdBatchSubmit(b);   }
+			b->buf[b->len++] = (uint8_t)((Address<<1)&0x7E);
+			b->segLen[b->segments++] = 1;
+			b->lastIsRead = 0;
+			b->lastReg = Address;
+		}
+		n = BATCH_MAX_BYTES - b->len;
+		if (n > len) {   n = len;   }
+		memcpy(b->buf+b->len,pData,n);
+		b->len += n;
+		b->segLen[b->segments-1] += n;
+		pData += n;
+		len -= n;
+	}
+}
+
+void PcdBatchWrite(rc522_batch *b, uint8_t Address, uint8_t value)
+{
+	PcdBatchWriteBurst(b,Address,&value,1);
+}
+
+// *pOut is valid after PcdBatchSubmit
+void PcdBatchRead(rc522_batch *b, uint8_t Address, uint8_t *pOut)
+{
+	if (b->reads == BATCH_MAX_READS || b->len + 2 > BATCH_MAX_BYTES ||
+		(!b->lastIsRead && b->segments == BATCH_MAX_SEGMENTS))
+	{   PcdBatchSubmit(b);   }
+
+	if (b->segments > 0 && b->lastIsRead)
+	{
+		// the terminating byte of the open read frame becomes this address
+		b->buf[b->len-1] = ((Address<<1)&0x7E)|0x80;
+		b->segLen[b->segments-1]++;
+	}
+	else
+	{
+		b->buf[b->len++] = ((Address<<1)&0x7E)|0x80;
+		b->segLen[b->segments++] = 2;
+		b->lastIsRead = 1;
+	}
+	b->buf[b->len++] = 0;
+	b->readOut[b->reads] = pOut;
+	b->readPos[b->reads++] = b->len-1;
 }
 
 void SetBitMask(uint8_t   reg,uint8_t   mask)
 {
 	char   tmp = 0x0;
-	tmp = ReadRawRC(reg);
+	tmp = ReadShadowRC(reg);
 	WriteRawRC(reg,tmp | mask);  // set bit mask
 }
 
 void ClearBitMask(uint8_t   reg,uint8_t   mask)
 {
 	char   tmp = 0x0;
-	tmp = ReadRawRC(reg);
+	tmp = ReadShadowRC(reg);
 	WriteRawRC(reg, tmp & ~mask);  // clear bit mask
 }
 
-char PcdComMF522(uint8_t   Command,
+// Load the FIFO and start Command, returns without waiting for the chip.
+// Only one command can be in flight per reader; PcdComMF522Poll or
+// PcdComMF522Wait tell when it ended and PcdComMF522Finish collects it.
+void PcdComMF522Start(uint8_t   Command,
 		uint8_t *pIn ,
-		uint8_t   InLenByte,
-		uint8_t *pOut ,
-		uint8_t *pOutLenBit)
+		uint8_t   InLenByte)
 {
-	char   status = TAG_ERR;
 	uint8_t   irqEn   = 0x00;
 	uint8_t   waitFor = 0x00;
-	uint8_t   lastBits;
-	uint8_t   n;
-	uint32_t   i;
-	uint8_t PcdErr;
+	uint8_t   tmode;
+	rc522_batch batch;
 
 	//	printf("CMD %02x\n",pIn[0]);
 	switch (Command)
@@ -327,56 +782,121 @@ char PcdComMF522(uint8_t   Command,
 	default:
 		break;
 	}
-
-	WriteRawRC(ComIEnReg,irqEn|0x80);
+	dev->command = Command;
+	dev->irqEn = irqEn;
+	dev->waitFor = waitFor;
+	dev->comIrq = 0;
+	// Authentication takes at least the AUTH frame and the tag's nonce, a
+	// probe is over once answered or timed out
+	dev->waitUs = dev->probe ? PCD_PROBE_US :
+		Command == PCD_TRANSCEIVE ? (InLenByte + dev->expectRx) * PCD_BYTE_US + PCD_FDT_US :
+		Command == PCD_AUTHENT ? (4 + 4) * PCD_BYTE_US + PCD_FDT_US : 0;
+	tmode = dev->probe ? PCD_TMODE_PROBE : PCD_TMODE;
+	dev->expectRx = 0;
+	dev->probe = 0;
+
+	PcdBatchBegin(&batch);
+	if (ReadShadowRC(TModeReg) != tmode)
+	{   PcdBatchWrite(&batch,TModeReg,tmode);   }
+	// In IRQ mode only the interrupts that end the command drive the pin
+	PcdBatchWrite(&batch,ComIEnReg,(dev->irq ? (waitFor|0x01) : irqEn)|0x80);
 	//	WriteRawRC(ComIEnReg,irqEn);
-	ClearBitMask(ComIrqReg,0x80);
-	SetBitMask(FIFOLevelReg,0x80);
-	WriteRawRC(CommandReg,PCD_IDLE);
+	PcdBatchWrite(&batch,ComIrqReg,0x7F);		// clear all IRQ bits
+	PcdBatchWrite(&batch,FIFOLevelReg,0x80);	// flush FIFO
+	PcdBatchWrite(&batch,CommandReg,PCD_IDLE);
 
-	for (i=0; i<InLenByte; i++) {
-		WriteRawRC(FIFODataReg, pIn [i]);
-	}
+	PcdBatchWriteBurst(&batch,FIFODataReg,pIn,InLenByte);
 
-	WriteRawRC(CommandReg, Command);
+	PcdBatchWrite(&batch,CommandReg, Command);
 
 	if (Command == PCD_TRANSCEIVE) {
-		SetBitMask(BitFramingReg,0x80);
+		PcdBatchWrite(&batch,BitFramingReg,ReadShadowRC(BitFramingReg)|0x80);
 	}
+	PcdBatchSubmit(&batch);
+}
+
+// One ComIrqReg read, nonzero once the running command has ended
+uint8_t PcdComMF522Poll(void)
+{
+	dev->comIrq = ReadRawRC(ComIrqReg);
+	return (dev->comIrq & 0x01) || (dev->comIrq & dev->waitFor);
+}
+
+// Block until the running command ended, returns 0 on timeout
+uint8_t PcdComMF522Wait(void)
+{
+	uint32_t   i;
+	uint8_t   done;
 
 	//i = 600;//���ʱ��Ƶ�ʵ������M1�����ȴ�ʱ��25ms
+	if (dev->irq)
+	{
+		dev->transport->wait_irq(dev->transport->ctx,150*200);
+		return PcdComMF522Poll();
+	}
+
+	// Nothing to poll for until the frames are on the air, the answer is
+	// due right after that so the first polls come quicker
 	i = 150;
+	if (dev->waitUs > 200)
+	{
+		Rc522Delay(dev->waitUs);
+		for (done = PcdComMF522Poll(); !done && i > 146; i--)
+		{
+			Rc522Delay(50);
+			done = PcdComMF522Poll();
+		}
+		if (done) {return done;}
+	}
 	do
 	{
-		usleep(200);
+		Rc522Delay(200);
 		//		bcm2835_delayMicroseconds(200);
-		n = ReadRawRC(ComIrqReg);
-		i--;
+		done = PcdComMF522Poll();
 	}
-	while ((i!=0) && (!(n&0x01)) && (!(n&waitFor)));
+	while ((--i!=0) && (!done));
+	return done;
+}
 
-	ClearBitMask(BitFramingReg,0x80);
+char PcdComMF522Finish(uint8_t *pOut ,
+		uint8_t *pOutLenBit,
+		uint8_t   done)
+{
+	char   status = TAG_ERR;
+	uint8_t   lastBits;
+	uint8_t   n;
+	uint8_t PcdErr, level, control;
+	rc522_batch batch;
 
-	if (i!=0)
+	PcdBatchBegin(&batch);
+	PcdBatchWrite(&batch,BitFramingReg,ReadShadowRC(BitFramingReg)&~0x80);
+	if (done)
 	{
-		PcdErr=ReadRawRC(ErrorReg);
+		PcdBatchRead(&batch,ErrorReg,&PcdErr);
+		PcdBatchRead(&batch,FIFOLevelReg,&level);
+		PcdBatchRead(&batch,ControlReg,&control);
+	}
+	PcdBatchSubmit(&batch);
+
+	if (done)
+	{
+		n = dev->comIrq;
 		if (!(PcdErr & 0x11))
 		{
 			status = TAG_OK;
-			if (n & irqEn & 0x01) {status = TAG_NOTAG;}
-			if (Command == PCD_TRANSCEIVE) {
-				n = ReadRawRC(FIFOLevelReg);
-				lastBits = ReadRawRC(ControlReg) & 0x07;
+			if (PcdErr & 0x04) {status = TAG_ERRCRC;}
+			if (n & dev->irqEn & 0x01) {status = TAG_NOTAG;}
+			if (dev->command == PCD_TRANSCEIVE) {
+				n = level;
+				lastBits = control & 0x07;
 				if (lastBits) {*pOutLenBit = (n-1)*8 + lastBits;}
 				else {*pOutLenBit = n*8;}
 
 				if (n == 0) {n = 1;}
 				if (n > MAXRLEN) {n = MAXRLEN;}
 
-				for (i=0; i<n; i++) {
-					pOut [i] = ReadRawRC(FIFODataReg);
-//					printf (".%02X ",pOut[i]);
-				}
+				// A timeout leaves nothing in the FIFO
+				if (status != TAG_NOTAG) {ReadRawRCBurst(FIFODataReg,pOut,n);}
 			}
 		}
 		else {
@@ -398,6 +918,16 @@ char PcdComMF522(uint8_t   Command,
 	return status;
 }
 
+char PcdComMF522(uint8_t   Command,
+		uint8_t *pIn ,
+		uint8_t   InLenByte,
+		uint8_t *pOut ,
+		uint8_t *pOutLenBit)
+{
+	PcdComMF522Start(Command,pIn,InLenByte);
+	return PcdComMF522Finish(pOut,pOutLenBit,PcdComMF522Wait());
+}
+
 void PcdAntennaOn(void)
 {
 	uint8_t   i;
@@ -412,3 +942,36 @@ void PcdAntennaOff(void)
 {
 	ClearBitMask(TxControlReg, 0x03);
 }
+
+// Soft power-down: the oscillator and the field stop, the registers keep
+// their values
+void PcdPowerDown(void)
+{
+	WriteRawRC(CommandReg,PCD_IDLE|0x10);
+}
+
+// PowerDown reads 1 until the oscillator is stable again, about 76us. The
+// field comes back on by itself, tags still need PCD_FIELD_ON_US.
+void PcdPowerUp(void)
+{
+	uint8_t i;
+	WriteRawRC(CommandReg,PCD_IDLE);
+	for (i=0; i<PCD_WAKE_TRIES && (ReadRawRC(CommandReg) & 0x10); i++)
+	{
+		Rc522Delay(20);
+	}
+}
+
+// SAK of the tag selected last
+uint8_t PcdSak(void)
+{
+	return dev->sak;
+}
+
+// Switch the field off for us microseconds, every tag returns to IDLE
+void PcdFieldReset(uint32_t us)
+{
+	PcdAntennaOff();
+	Rc522Delay(us);
+	PcdAntennaOn();
+}
@@ -1,4 +1,8 @@
+#ifndef RC522_H_
+#define RC522_H_
+
 #include <stdint.h>
+#include "transport.h"
 
 //MF522 command
 #define PCD_IDLE              0x00
@@ -24,10 +28,35 @@
 #define PICC_RESTORE          0xC2
 #define PICC_TRANSFER         0xB0
 #define PICC_HALT             0x50
+// Ultralight EV1/NTAG21x
+#define PICC_GET_VERSION      0x60
+#define PICC_FAST_READ        0x3A
 
 //MF522 FIFO
+// Air time of one byte with parity at 106kBd and the minimum frame delay
+#define PCD_BYTE_US           85
+#define PCD_FDT_US            86
+
 #define DEF_FIFO_LENGTH       64                 //FIFO size=64byte
 #define MAXRLEN               18
+// HiAlertIRq fires once no more than this many FIFO bytes are free, long
+// answers are drained from then on with 32 bytes (2.7ms) to spare
+#define PCD_WATER_LEVEL       32
+// Time tags get to power up once the field is back on (ISO14443-3 5.1)
+#define PCD_FIELD_ON_US       5000
+// Checks of CommandReg while the oscillator restarts after a soft power-down
+#define PCD_WAKE_TRIES        20
+// TModeReg: TAuto and a prescaler of 0xD3E, (2*0xD3E+1)/13.56MHz = 0.5ms
+// ticks, with TReloadReg at 30 a receive timeout of 15.5ms
+#define PCD_TMODE             0x8D
+// TModeReg for REQA/WUPA: a prescaler of 0x03E gives 9.2us ticks, so an
+// empty field times out 31 ticks = 286us after the request. The ATQA starts
+// 86us (PCD_FDT_US) after the request and the timer stops at its 5th bit.
+// PcdComMF522Start only writes TModeReg when it changes, polling an empty
+// field keeps this one.
+#define PCD_TMODE_PROBE       0x80
+// A REQA/WUPA has been answered or timed out this long after it was sent
+#define PCD_PROBE_US          (PCD_BYTE_US + 286)
 
 //MF522 registers
 #define     CommandReg            0x01
@@ -91,11 +120,60 @@
 #define 	TAG_ERR                (2)
 #define 	TAG_ERRCRC             (3)
 #define 	TAG_COLLISION             (4)
+#define 	TAG_NAK                (5)
 typedef char tag_stat;
 
+// State of one physical reader. All Pcd* functions operate on the reader
+// last passed to Rc522Select.
+typedef struct rc522_dev
+{
+	rc522_transport *transport;
+	// Wait for command completion on the IRQ pin instead of polling ComIrqReg
+	uint8_t irq;
+	// Let the chip append and check CRC_A instead of doing it on the host
+	uint8_t crcOffload;
+	uint8_t version;
+	// SAK returned by the last successful PcdSelect
+	uint8_t sak;
+	// Command started by PcdComMF522Start and its last ComIrqReg value
+	uint8_t command;
+	uint8_t irqEn;
+	uint8_t waitFor;
+	uint8_t comIrq;
+	// Bytes the next transceive should receive, lets PcdComMF522Wait sleep
+	// through the exchange instead of polling; reset by PcdComMF522Start
+	uint8_t expectRx;
+	// The next transceive is a REQA/WUPA and runs with PCD_TMODE_PROBE;
+	// reset by PcdComMF522Start
+	uint8_t probe;
+	uint32_t waitUs;
+	// Last value written to the configuration registers, see SHADOW_REGS
+	uint8_t shadow[64];
+	uint64_t shadowValid;
+} rc522_dev;
+
+#define BATCH_MAX_BYTES       160
+#define BATCH_MAX_SEGMENTS    16
+#define BATCH_MAX_READS       16
+
+// Register accesses queued by PcdBatchWrite/PcdBatchRead, sent by PcdBatchSubmit
+typedef struct rc522_batch
+{
+	uint8_t buf[BATCH_MAX_BYTES];
+	uint32_t len;
+	uint32_t segLen[BATCH_MAX_SEGMENTS];
+	uint8_t segments;
+	uint8_t lastIsRead;
+	uint8_t lastReg;
+	uint8_t *readOut[BATCH_MAX_READS];
+	uint16_t readPos[BATCH_MAX_READS];
+	uint8_t reads;
+} rc522_batch;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
+    void Rc522Select(rc522_dev *dev);
     void InitRc522(void);
     void ClearBitMask(uint8_t   reg,uint8_t   mask);
     void WriteRawRC(uint8_t   Address, uint8_t   value);
@@ -105,19 +183,42 @@ extern "C" {
                      uint8_t   InLenByte,
                      uint8_t *pOut ,
                      uint8_t  *pOutLenBit);
-    void CalulateCRC(uint8_t *pIn ,uint8_t   len,uint8_t *pOut );
+    void PcdComMF522Start(uint8_t Command, uint8_t *pIn, uint8_t InLenByte);
+    uint8_t PcdComMF522Poll(void);
+    uint8_t PcdComMF522Wait(void);
+    char PcdComMF522Finish(uint8_t *pOut, uint8_t *pOutLenBit, uint8_t done);
+    void CalulateCRC(uint8_t *pIn ,uint16_t   len,uint8_t *pOut );
     uint8_t ReadRawRC(uint8_t   Address);
+    void WriteRawRCBurst(uint8_t Address, const uint8_t *pData, uint8_t len);
+    void ReadRawRCBurst(uint8_t Address, uint8_t *pData, uint8_t len);
+    void PcdBatchBegin(rc522_batch *b);
+    void PcdBatchWrite(rc522_batch *b, uint8_t Address, uint8_t value);
+    void PcdBatchWriteBurst(rc522_batch *b, uint8_t Address, const uint8_t *pData, uint8_t len);
+    void PcdBatchRead(rc522_batch *b, uint8_t Address, uint8_t *pOut);
+    void PcdBatchSubmit(rc522_batch *b);
     char PcdReset(void);
+    char PcdCheck(void);
     char PcdRequest(unsigned char req_code,unsigned char *pTagType);
+    void PcdRequestStart(uint8_t req_code);
+    char PcdRequestFinish(uint8_t *pTagType, uint8_t done);
     void PcdAntennaOn(void);
     void PcdAntennaOff(void);
+    void PcdFieldReset(uint32_t us);
+    void PcdPowerDown(void);
+    void PcdPowerUp(void);
     //char M500PcdConfigISOType(unsigned char type);
     char PcdAnticoll(uint8_t , uint8_t *);
     char PcdSelect(uint8_t , uint8_t *);
+    uint8_t PcdSak(void);
     char PcdAuthState(unsigned char auth_mode,unsigned char addr,unsigned char *pKey,unsigned char *pSnr);
     char PcdWrite(unsigned char addr,unsigned char *pData);
     char PcdRead(unsigned char addr,unsigned char *pData);
     char PcdHalt(void);
+    char PcdTransceiveLong(uint8_t *pIn, uint8_t InLenByte, uint8_t *pOut, uint16_t maxOut, uint16_t *pOutLen);
+    char PcdGetVersion(uint8_t *pVersion);
+    char PcdFastRead(uint8_t start, uint8_t end, uint8_t *pData);
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
+
+#endif /* RC522_H_ */
@@ -0,0 +1,96 @@
+/*
+ * rc522_bench.c
+ *
+ *  Anticollision benchmark on the simulator: runs inventories over random
+ *  tag populations and reports how many tags were found and what a cycle
+ *  costs in virtual time, RF frames and collisions. Exits with 1 if any
+ *  inventory missed a tag.
+ *
+ *  rc522_bench [trials] [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rfid.h"
+#include "rc522_sim.h"
+
+static const uint8_t populations[] = {0, 1, 2, 3, 5, 8, 10, 16};
+
+// Number of simulated tags whose UID is in uids
+static uint8_t count_found(rc522_sim *sim, rfid_uid *uids, uint8_t count)
+{
+	uint8_t t, i, found = 0;
+
+	for (t = 0; t < sim->tagCount; t++)
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (uids[i].len == sim->tags[t].uidLen && memcmp(uids[i].sn, sim->tags[t].uid, uids[i].len) == 0)
+			{
+				found++;
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+int main(int argc, char **argv)
+{
+	static rc522_sim sim;
+	rc522_transport transport;
+	rc522_dev dev;
+	rfid_uid uids[INVENTORY_MAX_TAGS];
+	uint32_t trials = argc > 1 ? atoi(argv[1]) : 200;
+	uint32_t seed = argc > 2 ? atoi(argv[2]) : 1;
+	uint32_t trial, complete;
+	uint64_t start, elapsed, total, worst, found, frames, collisions;
+	uint16_t cardType;
+	uint8_t p, n, count;
+	int result = 0;
+
+	if (seed == 0)
+		seed = 1;
+
+	printf("tags  complete  found%%  avg ms  max ms  frames  collisions\n");
+	for (p = 0; p < sizeof(populations); p++)
+	{
+		n = populations[p];
+		complete = 0;
+		total = worst = found = frames = collisions = 0;
+
+		for (trial = 0; trial < trials; trial++)
+		{
+			rc522_sim_init(&sim);
+			rc522_sim_add_random_tags(&sim, n, &seed);
+			rc522_sim_transport(&sim, &transport);
+			memset(&dev, 0, sizeof(dev));
+			dev.transport = &transport;
+			Rc522Select(&dev);
+			InitRc522();
+
+			memset(&sim.stats, 0, sizeof(sim.stats));
+			start = sim.now_ns;
+			find_tag_start();
+			count = inventory_tags(find_tag_finish(&cardType, PcdComMF522Wait()), uids, INVENTORY_MAX_TAGS);
+			elapsed = sim.now_ns - start;
+
+			count = count_found(&sim, uids, count);
+			found += count;
+			complete += count == n;
+			total += elapsed;
+			if (elapsed > worst)
+				worst = elapsed;
+			frames += sim.stats.frames;
+			collisions += sim.stats.collisions;
+		}
+
+		printf("%4u  %8u  %6.1f  %6.2f  %6.2f  %6.1f  %10.1f\n", n, complete,
+			   n ? 100.0 * found / ((uint64_t)n * trials) : 100.0,
+			   total / 1e6 / trials, worst / 1e6,
+			   (double)frames / trials, (double)collisions / trials);
+		if (complete != trials)
+			result = 1;
+	}
+	return result;
+}
@@ -0,0 +1,954 @@
+/*
+ * rc522_sim.c
+ *
+ *  Register level model of the RC522 (register file, 64 byte FIFO, CommandReg
+ *  state machine, ComIrqReg/DivIrqReg/ErrorReg/CollReg, timer, CRC
+ *  coprocessor) driving a set of ISO14443A tags (REQA/WUPA, bit oriented
+ *  anticollision, SELECT, HALT, MIFARE Classic auth/read/write, Ultralight
+ *  and NTAG21x read/write, NTAG21x GET_VERSION/FAST_READ). Answers enter
+ *  the FIFO byte by byte at the air rate, so long ones overflow it unless
+ *  drained in time.
+ */
+#include <string.h>
+#include "rc522_sim.h"
+
+#define FC_HZ                 13560000ULL
+#define ETU_NS                9440       // 128/fc, one bit at 106 kbit/s
+#define FDT_NS                86000      // PICC frame delay time
+#define CRC_NS                2000
+#define AUTH_NS               1200000    // three pass authentication
+#define EEPROM_NS             2500000    // MIFARE write cycle
+
+#define PICC_STATE_IDLE       0
+#define PICC_STATE_READY      1
+#define PICC_STATE_ACTIVE     2
+#define PICC_STATE_HALT       3
+
+// GET_VERSION of an NTAG21x, byte 6 is the storage size
+static const uint8_t ntagVersion[8] = {0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x0F, 0x03};
+
+static const uint8_t resetValues[64] = {
+	0x00, 0x20, 0x80, 0x00, 0x14, 0x00, 0x00, 0x21,   // 0x00
+	0x00, 0x00, 0x00, 0x08, 0x10, 0x00, 0xA0, 0x00,   // 0x08
+	0x00, 0x3F, 0x00, 0x00, 0x80, 0x00, 0x10, 0x84,   // 0x10
+	0x84, 0x4D, 0x00, 0x00, 0x62, 0x00, 0x00, 0xEB,   // 0x18
+	0x00, 0xFF, 0xFF, 0x00, 0x26, 0x00, 0x48, 0x88,   // 0x20
+	0x20, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // 0x28
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x92,   // 0x30
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // 0x38
+};
+
+static uint8_t get_bit(const uint8_t *buf, uint32_t i)
+{
+	return (buf[i / 8] >> (i % 8)) & 1;
+}
+
+static void put_bit(uint8_t *buf, uint32_t i, uint8_t v)
+{
+	if (v)
+		buf[i / 8] |= 1 << (i % 8);
+	else
+		buf[i / 8] &= ~(1 << (i % 8));
+}
+
+static uint16_t crc_a(const uint8_t *data, uint32_t len, uint16_t crc)
+{
+	uint32_t i;
+	uint8_t b;
+
+	for (i = 0; i < len; i++)
+	{
+		b = data[i] ^ (uint8_t)crc;
+		b ^= b << 4;
+		crc = (crc >> 8) ^ ((uint16_t)b << 8) ^ ((uint16_t)b << 3) ^ (b >> 4);
+	}
+	return crc;
+}
+
+static uint8_t crc_ok(const uint8_t *data, uint32_t len)
+{
+	uint16_t crc;
+
+	if (len < 3)
+		return 0;
+	crc = crc_a(data, len - 2, 0x6363);
+	return data[len - 2] == (crc & 0xFF) && data[len - 1] == (crc >> 8);
+}
+
+static uint32_t append_crc(uint8_t *data, uint32_t len)
+{
+	uint16_t crc = crc_a(data, len, 0x6363);
+	data[len] = crc & 0xFF;
+	data[len + 1] = crc >> 8;
+	return len + 2;
+}
+
+static uint64_t frame_ns(uint32_t bits)
+{
+	// data bits, one parity bit per byte, start and end of frame
+	return (uint64_t)(bits + bits / 8 + 2) * ETU_NS;
+}
+
+static uint64_t timer_ns(rc522_sim *sim)
+{
+	uint32_t prescaler = ((sim->reg[TModeReg] & 0x0F) << 8) | sim->reg[TPrescalerReg];
+	uint32_t reload = (sim->reg[TReloadRegH] << 8) | sim->reg[TReloadRegL];
+	return (uint64_t)(2 * prescaler + 1) * (reload + 1) * 1000000000ULL / FC_HZ;
+}
+
+/////////////////////////////////////////////////////////////////////
+// Tags
+/////////////////////////////////////////////////////////////////////
+
+static uint8_t is_classic(rc522_sim_tag *tag)
+{
+	return tag->type == SIM_TAG_CLASSIC_1K || tag->type == SIM_TAG_CLASSIC_4K;
+}
+
+static int classic_sector(uint16_t block)
+{
+	return block < 128 ? block / 4 : 32 + (block - 128) / 16;
+}
+
+static int classic_trailer(int sector)
+{
+	return sector < 32 ? sector * 4 + 3 : 128 + (sector - 32) * 16 + 15;
+}
+
+static void tag_sleep(rc522_sim_tag *tag)
+{
+	tag->state = tag->halted ? PICC_STATE_HALT : PICC_STATE_IDLE;
+	tag->authSector = -1;
+	tag->writeBlock = -1;
+}
+
+static void tag_power_off(rc522_sim_tag *tag)
+{
+	tag->halted = 0;
+	tag_sleep(tag);
+}
+
+// UID part of cascade level 1..3 followed by its BCC
+static void tag_cln(rc522_sim_tag *tag, uint8_t level, uint8_t *cln)
+{
+	const uint8_t *uid = tag->uid;
+	uint8_t last = (tag->uidLen == 4 && level == 1) || (tag->uidLen == 7 && level == 2) || level == 3;
+
+	if (level > 1)
+		uid += 3;
+	if (level > 2)
+		uid += 3;
+
+	if (last)
+	{
+		memcpy(cln, uid, 4);
+	}
+	else
+	{
+		cln[0] = 0x88;
+		memcpy(cln + 1, uid, 3);
+	}
+	cln[4] = cln[0] ^ cln[1] ^ cln[2] ^ cln[3];
+}
+
+static uint8_t tag_levels(rc522_sim_tag *tag)
+{
+	return tag->uidLen == 4 ? 1 : tag->uidLen == 7 ? 2 : 3;
+}
+
+static void tag_format(rc522_sim_tag *tag)
+{
+	uint16_t i;
+	uint8_t *m = tag->memory;
+
+	memset(m, 0, sizeof(tag->memory));
+	if (is_classic(tag))
+	{
+		tag->memorySize = tag->type == SIM_TAG_CLASSIC_4K ? 4096 : 1024;
+		if (tag->uidLen == 4)
+		{
+			memcpy(m, tag->uid, 4);
+			m[4] = m[0] ^ m[1] ^ m[2] ^ m[3];
+			m[5] = tag->sak;
+			m[6] = tag->atqa[0];
+			m[7] = tag->atqa[1];
+		}
+		else
+		{
+			memcpy(m, tag->uid, 7);
+			m[7] = tag->sak;
+			m[8] = tag->atqa[0];
+			m[9] = tag->atqa[1];
+		}
+		for (i = 0; classic_trailer(i) * 16 < tag->memorySize; i++)
+		{
+			uint8_t *t = m + classic_trailer(i) * 16;
+			memset(t, 0xFF, 16);
+			t[6] = 0xFF;
+			t[7] = 0x07;
+			t[8] = 0x80;
+			t[9] = 0x69;
+		}
+	}
+	else
+	{
+		switch (tag->type)
+		{
+		case SIM_TAG_NTAG213: tag->memorySize = 45 * 4; break;
+		case SIM_TAG_NTAG215: tag->memorySize = 135 * 4; break;
+		case SIM_TAG_NTAG216: tag->memorySize = 231 * 4; break;
+		default: tag->memorySize = 16 * 4; break;
+		}
+		m[0] = tag->uid[0];
+		m[1] = tag->uid[1];
+		m[2] = tag->uid[2];
+		m[3] = 0x88 ^ m[0] ^ m[1] ^ m[2];
+		memcpy(m + 4, tag->uid + 3, 4);
+		m[8] = m[4] ^ m[5] ^ m[6] ^ m[7];
+		// capability container and an empty NDEF message
+		m[12] = 0xE1;
+		m[13] = 0x10;
+		m[14] = (tag->memorySize - 16) / 8;
+		m[16] = 0x03;
+		m[17] = 0x00;
+		m[18] = 0xFE;
+	}
+}
+
+// Response of one tag to a frame, in bits; 0 if the tag stays silent
+static uint32_t tag_frame(rc522_sim_tag *tag, const uint8_t *frame, uint32_t bits, uint8_t *r)
+{
+	uint8_t cln[5];
+	uint8_t level, sak, nvb;
+	uint32_t i, known, len;
+	int16_t block;
+
+	if (bits == 7)
+	{
+		uint8_t cmd = frame[0] & 0x7F;
+		if (cmd != PICC_REQIDL && cmd != PICC_REQALL)
+			return 0;
+		if (tag->state == PICC_STATE_IDLE || (cmd == PICC_REQALL && tag->state == PICC_STATE_HALT))
+		{
+			tag->halted = tag->state == PICC_STATE_HALT;
+			tag->state = PICC_STATE_READY;
+			tag->level = 1;
+			r[0] = tag->atqa[0];
+			r[1] = tag->atqa[1];
+			return 16;
+		}
+		if (tag->state != PICC_STATE_HALT)
+			tag_sleep(tag);
+		return 0;
+	}
+
+	if (bits >= 16 && (frame[0] == PICC_ANTICOLL1 || frame[0] == PICC_ANTICOLL2 || frame[0] == PICC_ANTICOLL3))
+	{
+		if (tag->state == PICC_STATE_ACTIVE)
+			tag_sleep(tag);
+		level = (frame[0] - PICC_ANTICOLL1) / 2 + 1;
+		if (tag->state != PICC_STATE_READY || level != tag->level)
+			return 0;
+		tag_cln(tag, level, cln);
+		nvb = frame[1];
+
+		if (nvb == 0x70)
+		{
+			if (bits != 72 || !crc_ok(frame, 9))
+				return 0;
+			if (memcmp(frame + 2, cln, 5) != 0)
+			{
+				tag_sleep(tag);
+				return 0;
+			}
+			if (level == tag_levels(tag))
+			{
+				tag->state = PICC_STATE_ACTIVE;
+				sak = tag->sak;
+			}
+			else
+			{
+				tag->level++;
+				sak = 0x04;
+			}
+			r[0] = sak;
+			append_crc(r, 1);
+			return 24;
+		}
+
+		if ((nvb >> 4) < 2 || (nvb & 0x0F) > 7)
+			return 0;
+		known = ((nvb >> 4) - 2) * 8 + (nvb & 0x0F);
+		if (known >= 40 || bits < 16 + known)
+			return 0;
+		for (i = 0; i < known; i++)
+		{
+			if (get_bit(frame + 2, i) != get_bit(cln, i))
+				return 0;
+		}
+		for (i = known; i < 40; i++)
+			put_bit(r, i - known, get_bit(cln, i));
+		return 40 - known;
+	}
+
+	if (tag->state != PICC_STATE_ACTIVE)
+		return 0;
+
+	len = bits / 8;
+	if (bits % 8 || !crc_ok(frame, len))
+		return 0;
+
+	if (tag->writeBlock >= 0)
+	{
+		block = tag->writeBlock;
+		tag->writeBlock = -1;
+		if (len != 18)
+		{
+			tag_sleep(tag);
+			return 0;
+		}
+		if (is_classic(tag))
+			memcpy(tag->memory + block * 16, frame, 16);
+		else
+			memcpy(tag->memory + block * 4, frame, 4);
+		r[0] = 0x0A;
+		return 4;
+	}
+
+	switch (frame[0])
+	{
+	case PICC_HALT:
+		if (len == 4 && frame[1] == 0)
+		{
+			tag->state = PICC_STATE_HALT;
+			tag->halted = 1;
+			tag->authSector = -1;
+		}
+		return 0;
+
+	case PICC_READ:
+		if (len != 4)
+			break;
+		block = frame[1];
+		if (block == tag->nakBlock)
+			break;
+		if (is_classic(tag))
+		{
+			if (block * 16 >= tag->memorySize || classic_sector(block) != tag->authSector)
+				break;
+			memcpy(r, tag->memory + block * 16, 16);
+			if (block == classic_trailer(tag->authSector))
+				memset(r, 0, 6);
+		}
+		else
+		{
+			if (block * 4 >= tag->memorySize)
+				break;
+			for (i = 0; i < 16; i++)
+				r[i] = tag->memory[(block * 4 + i) % tag->memorySize];
+		}
+		append_crc(r, 16);
+		return 18 * 8;
+
+	case PICC_WRITE:
+		if (len != 4)
+			break;
+		block = frame[1];
+		if (is_classic(tag))
+		{
+			if (block == 0 || block * 16 >= tag->memorySize || classic_sector(block) != tag->authSector)
+				break;
+		}
+		else if (block < 2 || block * 4 >= tag->memorySize)
+		{
+			break;
+		}
+		tag->writeBlock = block;
+		r[0] = 0x0A;
+		return 4;
+
+	case PICC_GET_VERSION:
+		// not known to MIFARE Classic and the original Ultralight
+		if (len != 3 || is_classic(tag) || tag->type == SIM_TAG_ULTRALIGHT)
+		{
+			tag_sleep(tag);
+			return 0;
+		}
+		memcpy(r, ntagVersion, 8);
+		r[6] = tag->type == SIM_TAG_NTAG213 ? 0x0F : tag->type == SIM_TAG_NTAG215 ? 0x11 : 0x13;
+		append_crc(r, 8);
+		return 10 * 8;
+
+	case PICC_FAST_READ:
+		if (len != 5 || is_classic(tag) || tag->type == SIM_TAG_ULTRALIGHT)
+		{
+			tag_sleep(tag);
+			return 0;
+		}
+		if (frame[1] > frame[2] || frame[2] * 4 >= tag->memorySize)
+			break;
+		i = (frame[2] - frame[1] + 1) * 4;
+		memcpy(r, tag->memory + frame[1] * 4, i);
+		append_crc(r, i);
+		return (i + 2) * 8;
+
+	default:
+		tag_sleep(tag);
+		return 0;
+	}
+
+	// NAK
+	tag_sleep(tag);
+	r[0] = 0x04;
+	return 4;
+}
+
+// Superimposes the responses of all tags in the field. Returns the number
+// of bits received and the index of the first collided bit in *coll.
+static uint32_t field_frame(rc522_sim *sim, const uint8_t *frame, uint32_t bits, uint8_t *resp, int32_t *coll)
+{
+	uint8_t r[SIM_FRAME_MAX];
+	uint32_t total = 0, rb, i, n;
+	uint8_t t;
+
+	*coll = -1;
+	for (t = 0; t < sim->tagCount; t++)
+	{
+		if (!sim->tags[t].present)
+			continue;
+		memset(r, 0, sizeof(r));
+		rb = tag_frame(&sim->tags[t], frame, bits, r);
+		if (!rb)
+			continue;
+		if (!total)
+		{
+			memcpy(resp, r, (rb + 7) / 8);
+			total = rb;
+			continue;
+		}
+		n = rb < total ? rb : total;
+		for (i = 0; i < n; i++)
+		{
+			if (get_bit(resp, i) != get_bit(r, i))
+			{
+				if (*coll < 0 || i < (uint32_t)*coll)
+					*coll = i;
+				put_bit(resp, i, 1);
+			}
+		}
+		if (rb != total && (*coll < 0 || n < (uint32_t)*coll))
+			*coll = n;
+		if (rb > total)
+		{
+			for (i = total; i < rb; i++)
+				put_bit(resp, i, get_bit(r, i));
+			total = rb;
+		}
+	}
+	return total;
+}
+
+/////////////////////////////////////////////////////////////////////
+// Chip
+/////////////////////////////////////////////////////////////////////
+
+static void fifo_alerts(rc522_sim *sim)
+{
+	uint8_t water = sim->reg[WaterLevelReg] & 0x3F;
+	if (sim->fifoLen <= water)
+		sim->reg[ComIrqReg] |= 0x04;
+	if (DEF_FIFO_LENGTH - sim->fifoLen <= water)
+		sim->reg[ComIrqReg] |= 0x08;
+}
+
+static void fifo_push(rc522_sim *sim, uint8_t value)
+{
+	if (sim->fifoLen == DEF_FIFO_LENGTH)
+	{
+		sim->reg[ErrorReg] |= 0x10;
+		return;
+	}
+	sim->fifo[sim->fifoLen++] = value;
+	fifo_alerts(sim);
+}
+
+static uint8_t fifo_pop(rc522_sim *sim)
+{
+	uint8_t value;
+
+	if (!sim->fifoLen)
+		return 0;
+	value = sim->fifo[0];
+	sim->fifoLen--;
+	memmove(sim->fifo, sim->fifo + 1, sim->fifoLen);
+	fifo_alerts(sim);
+	return value;
+}
+
+static void field_off(rc522_sim *sim)
+{
+	uint8_t t;
+	for (t = 0; t < sim->tagCount; t++)
+		tag_power_off(&sim->tags[t]);
+	sim->reg[Status2Reg] &= ~0x08;
+}
+
+static void start_pending(rc522_sim *sim, uint64_t at)
+{
+	sim->pending = 1;
+	sim->doneAt = at;
+	sim->doneComIrq = 0;
+	sim->doneDivIrq = 0;
+	sim->doneError = 0;
+	sim->doneColl = 0x20;
+	sim->doneIdle = 0;
+	sim->doneStatus2 = 0;
+	sim->doneLen = 0;
+	sim->doneLastBits = 0;
+	sim->doneRxStart = at;
+	sim->donePushed = 0;
+}
+
+// When byte i of the running command's answer is in the FIFO
+static uint64_t rx_byte_at(rc522_sim *sim, uint16_t i)
+{
+	uint64_t at = sim->doneRxStart + frame_ns((i + 1) * 8);
+	return at < sim->doneAt ? at : sim->doneAt;
+}
+
+static void update(rc522_sim *sim)
+{
+	uint16_t i;
+
+	if (!sim->pending)
+		return;
+	while (sim->donePushed < sim->doneLen && rx_byte_at(sim, sim->donePushed) <= sim->now_ns)
+		fifo_push(sim, sim->done[sim->donePushed++]);
+	if (sim->now_ns < sim->doneAt)
+		return;
+	sim->pending = 0;
+
+	for (i = sim->donePushed; i < sim->doneLen; i++)
+		fifo_push(sim, sim->done[i]);
+	sim->reg[ControlReg] = (sim->reg[ControlReg] & ~0x07) | sim->doneLastBits;
+	sim->reg[ErrorReg] |= sim->doneError;
+	sim->reg[CollReg] = (sim->reg[CollReg] & 0x80) | sim->doneColl;
+	sim->reg[Status2Reg] |= sim->doneStatus2;
+	sim->reg[ComIrqReg] |= sim->doneComIrq;
+	if (sim->reg[ErrorReg])
+		sim->reg[ComIrqReg] |= 0x02;
+	sim->reg[DivIrqReg] |= sim->doneDivIrq;
+	if (sim->doneIdle)
+		sim->reg[CommandReg] &= ~0x0F;
+}
+
+static void transceive(rc522_sim *sim)
+{
+	uint8_t frame[SIM_FRAME_MAX];
+	uint8_t resp[SIM_FRAME_MAX];
+	uint8_t txLastBits = sim->reg[BitFramingReg] & 0x07;
+	uint8_t rxAlign = (sim->reg[BitFramingReg] >> 4) & 0x07;
+	uint32_t len = sim->fifoLen, bits, respBits = 0, i, pos;
+	uint64_t txEnd;
+	int32_t coll = -1;
+	uint8_t t, writing = 0;
+
+	for (t = 0; t < sim->tagCount; t++)
+	{
+		if (sim->tags[t].writeBlock >= 0)
+			writing = 1;
+	}
+
+	memcpy(frame, sim->fifo, len);
+	sim->fifoLen = 0;
+	fifo_alerts(sim);
+
+	bits = len * 8;
+	if (txLastBits && len)
+		bits -= 8 - txLastBits;
+	if ((sim->reg[TxModeReg] & 0x80) && !txLastBits)
+	{
+		len = append_crc(frame, len);
+		bits += 16;
+	}
+
+	sim->reg[ErrorReg] = 0;
+	sim->stats.frames++;
+	txEnd = sim->now_ns + frame_ns(bits);
+	memset(resp, 0, sizeof(resp));
+	if (bits && (sim->reg[TxControlReg] & 0x03) && !(sim->reg[CommandReg] & 0x10))
+		respBits = field_frame(sim, frame, bits, resp, &coll);
+
+	start_pending(sim, txEnd);
+	sim->doneComIrq = 0x40;
+
+	if (respBits)
+	{
+		if ((sim->reg[RxModeReg] & 0x80) && !(respBits % 8))
+		{
+			if (respBits < 24 || !crc_ok(resp, respBits / 8))
+				sim->doneError |= 0x04;
+			else
+				respBits -= 16;
+		}
+
+		memset(sim->done, 0, sizeof(sim->done));
+		for (i = 0; i < respBits; i++)
+			put_bit(sim->done, rxAlign + i, get_bit(resp, i));
+		sim->doneLen = (rxAlign + respBits + 7) / 8;
+		sim->doneLastBits = (rxAlign + respBits) % 8;
+		sim->doneAt = txEnd + FDT_NS + frame_ns(respBits);
+		sim->doneComIrq |= 0x20;
+
+		if (coll >= 0)
+		{
+			pos = rxAlign + coll + 1;
+			sim->doneError |= 0x08;
+			sim->doneColl = pos > 32 ? 0x20 : pos & 0x1F;
+			sim->stats.collisions++;
+		}
+		// a write is acknowledged after the EEPROM cycle
+		if (writing && respBits == 4)
+			sim->doneAt += EEPROM_NS;
+		sim->doneRxStart = sim->doneAt - frame_ns(respBits);
+	}
+	else if (sim->reg[TModeReg] & 0x80)
+	{
+		sim->doneAt = txEnd + timer_ns(sim);
+		sim->doneComIrq |= 0x01;
+		sim->stats.timeouts++;
+	}
+}
+
+static void authent(rc522_sim *sim)
+{
+	rc522_sim_tag *tag = NULL;
+	uint8_t *f = sim->fifo;
+	uint8_t t;
+	int sector;
+	const uint8_t *key;
+
+	for (t = 0; t < sim->tagCount; t++)
+	{
+		if (sim->tags[t].present && sim->tags[t].state == PICC_STATE_ACTIVE)
+			tag = &sim->tags[t];
+	}
+
+	if (tag && sim->fifoLen >= 12 && is_classic(tag) && f[1] * 16 < tag->memorySize &&
+		memcmp(f + 8, tag->uid + tag->uidLen - 4, 4) == 0)
+	{
+		sector = classic_sector(f[1]);
+		key = tag->memory + classic_trailer(sector) * 16 + (f[0] == PICC_AUTHENT1B ? 10 : 0);
+		if ((f[0] == PICC_AUTHENT1A || f[0] == PICC_AUTHENT1B) && memcmp(f + 2, key, 6) == 0)
+		{
+			tag->authSector = sector;
+			start_pending(sim, sim->now_ns + AUTH_NS);
+			sim->doneComIrq = 0x10;
+			sim->doneIdle = 1;
+			sim->doneStatus2 = 0x08;
+			sim->fifoLen = 0;
+			return;
+		}
+	}
+
+	if (tag)
+		tag_sleep(tag);
+	sim->fifoLen = 0;
+	if (sim->reg[TModeReg] & 0x80)
+	{
+		start_pending(sim, sim->now_ns + frame_ns(4 * 8) + timer_ns(sim));
+		sim->doneComIrq = 0x01;
+		sim->stats.timeouts++;
+	}
+}
+
+static void calc_crc(rc522_sim *sim)
+{
+	static const uint16_t preset[4] = {0x0000, 0x6363, 0xA671, 0xFFFF};
+	uint16_t crc = crc_a(sim->fifo, sim->fifoLen, preset[sim->reg[ModeReg] & 0x03]);
+
+	sim->reg[CRCResultRegL] = crc & 0xFF;
+	sim->reg[CRCResultRegM] = crc >> 8;
+	sim->reg[Status1Reg] |= 0x20;
+	start_pending(sim, sim->now_ns + CRC_NS + sim->fifoLen * 600);
+	sim->doneDivIrq = 0x04;
+	sim->fifoLen = 0;
+	fifo_alerts(sim);
+}
+
+static void soft_reset(rc522_sim *sim)
+{
+	memcpy(sim->reg, resetValues, sizeof(sim->reg));
+	sim->fifoLen = 0;
+	sim->pending = 0;
+	field_off(sim);
+}
+
+static void command(rc522_sim *sim, uint8_t value)
+{
+	sim->pending = 0;
+	sim->reg[CommandReg] = value & 0x3F;
+	// Soft power-down, the transmitter stops too
+	if (value & 0x10)
+		field_off(sim);
+
+	switch (value & 0x0F)
+	{
+	case PCD_CALCCRC:
+		calc_crc(sim);
+		break;
+	case PCD_AUTHENT:
+		authent(sim);
+		break;
+	case PCD_RESETPHASE:
+		soft_reset(sim);
+		break;
+	default:
+		break;
+	}
+}
+
+static uint8_t irq_asserted(rc522_sim *sim);
+
+static uint8_t reg_read(rc522_sim *sim, uint8_t reg)
+{
+	uint8_t water, status;
+
+	switch (reg)
+	{
+	case FIFODataReg:
+		return fifo_pop(sim);
+	case FIFOLevelReg:
+		return sim->fifoLen;
+	case Status1Reg:
+		water = sim->reg[WaterLevelReg] & 0x3F;
+		status = sim->reg[Status1Reg] & 0x20;
+		if (sim->fifoLen <= water)
+			status |= 0x01;
+		if (DEF_FIFO_LENGTH - sim->fifoLen <= water)
+			status |= 0x02;
+		if (irq_asserted(sim))
+			status |= 0x10;
+		return status;
+	default:
+		return sim->reg[reg];
+	}
+}
+
+static void reg_write(rc522_sim *sim, uint8_t reg, uint8_t value)
+{
+	uint8_t old = sim->reg[reg];
+
+	switch (reg)
+	{
+	case CommandReg:
+		command(sim, value);
+		break;
+	case ComIrqReg:
+	case DivIrqReg:
+		if (value & 0x80)
+			sim->reg[reg] |= value & 0x7F;
+		else
+			sim->reg[reg] &= ~value;
+		break;
+	case FIFODataReg:
+		fifo_push(sim, value);
+		break;
+	case FIFOLevelReg:
+		if (value & 0x80)
+		{
+			sim->fifoLen = 0;
+			sim->reg[ErrorReg] &= ~0x10;
+			fifo_alerts(sim);
+		}
+		break;
+	case BitFramingReg:
+		sim->reg[reg] = value;
+		if ((value & 0x80) && !(old & 0x80) && (sim->reg[CommandReg] & 0x0F) == PCD_TRANSCEIVE)
+			transceive(sim);
+		break;
+	case TxControlReg:
+		sim->reg[reg] = value;
+		if ((old & 0x03) && !(value & 0x03))
+			field_off(sim);
+		break;
+	case CollReg:
+		sim->reg[reg] = (old & 0x7F) | (value & 0x80);
+		break;
+	case ErrorReg:
+	case Status1Reg:
+	case VersionReg:
+		break;
+	default:
+		sim->reg[reg] = value;
+		break;
+	}
+}
+
+static void sim_transfer(void *ctx, uint8_t *buf, uint32_t len)
+{
+	rc522_sim *sim = (rc522_sim *)ctx;
+	uint32_t i;
+	uint8_t addr, next;
+
+	sim->stats.transfers++;
+	sim->stats.bytes += len;
+	sim->now_ns += sim->transferOverheadNs + (uint64_t)len * 8 * 1000000000ULL / sim->spiHz;
+	update(sim);
+	if (!len)
+		return;
+
+	if (buf[0] & 0x80)
+	{
+		// every byte clocks out the register addressed by the previous one
+		next = buf[0];
+		buf[0] = 0;
+		for (i = 1; i < len; i++)
+		{
+			addr = (next >> 1) & 0x3F;
+			next = buf[i];
+			buf[i] = reg_read(sim, addr);
+			sim->stats.regReads++;
+		}
+	}
+	else
+	{
+		addr = (buf[0] >> 1) & 0x3F;
+		buf[0] = 0;
+		for (i = 1; i < len; i++)
+		{
+			reg_write(sim, addr, buf[i]);
+			buf[i] = 0;
+			sim->stats.regWrites++;
+		}
+	}
+}
+
+static void sim_delay_us(void *ctx, uint32_t us)
+{
+	rc522_sim *sim = (rc522_sim *)ctx;
+	sim->now_ns += (uint64_t)us * 1000;
+	update(sim);
+}
+
+static uint8_t irq_asserted(rc522_sim *sim)
+{
+	return (sim->reg[ComIrqReg] & sim->reg[ComIEnReg] & 0x7F) || (sim->reg[DivIrqReg] & sim->reg[DivlEnReg] & 0x14);
+}
+
+static uint8_t sim_wait_irq(void *ctx, uint32_t timeout_us)
+{
+	rc522_sim *sim = (rc522_sim *)ctx;
+	uint64_t deadline = sim->now_ns + (uint64_t)timeout_us * 1000;
+	uint64_t next;
+
+	sim->stats.irqWaits++;
+	update(sim);
+	// step through the arrival of the answer's bytes, the FIFO alerts may
+	// assert the pin before the command is done
+	while (!irq_asserted(sim) && sim->pending)
+	{
+		next = sim->donePushed < sim->doneLen ? rx_byte_at(sim, sim->donePushed) : sim->doneAt;
+		if (next > deadline)
+			break;
+		if (next > sim->now_ns)
+			sim->now_ns = next;
+		update(sim);
+	}
+	if (irq_asserted(sim))
+		return 1;
+	sim->now_ns = deadline;
+	return 0;
+}
+
+void rc522_sim_init(rc522_sim *sim)
+{
+	memset(sim, 0, sizeof(*sim));
+	memcpy(sim->reg, resetValues, sizeof(sim->reg));
+	sim->spiHz = 250000000 / 512;
+	sim->transferOverheadNs = 5000;
+}
+
+rc522_sim_tag *rc522_sim_add_tag(rc522_sim *sim, uint8_t type, const uint8_t *uid, uint8_t uidLen)
+{
+	rc522_sim_tag *tag;
+	uint8_t size;
+
+	if (sim->tagCount == SIM_MAX_TAGS || (uidLen != 4 && uidLen != 7 && uidLen != 10))
+		return NULL;
+
+	tag = &sim->tags[sim->tagCount++];
+	memset(tag, 0, sizeof(*tag));
+	tag->type = type;
+	memcpy(tag->uid, uid, uidLen);
+	tag->uidLen = uidLen;
+	tag->nakBlock = -1;
+	size = uidLen == 4 ? 0x00 : uidLen == 7 ? 0x40 : 0x80;
+	switch (type)
+	{
+	case SIM_TAG_CLASSIC_1K:
+		tag->atqa[0] = 0x04 | size;
+		tag->sak = 0x08;
+		break;
+	case SIM_TAG_CLASSIC_4K:
+		tag->atqa[0] = 0x02 | size;
+		tag->sak = 0x18;
+		break;
+	default:
+		tag->atqa[0] = 0x04 | size;
+		tag->sak = 0x00;
+		break;
+	}
+	tag_format(tag);
+	tag->present = 1;
+	tag_power_off(tag);
+	return tag;
+}
+
+void rc522_sim_set_present(rc522_sim_tag *tag, uint8_t present)
+{
+	tag->present = present;
+	tag_power_off(tag);
+}
+
+// xorshift32, *seed must not be 0
+static uint32_t sim_random(uint32_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	return *seed;
+}
+
+// Adds count tags with random UIDs of random size and type, for anticollision
+// benchmarks. Returns the number of tags added.
+uint8_t rc522_sim_add_random_tags(rc522_sim *sim, uint8_t count, uint32_t *seed)
+{
+	static const uint8_t sizes[] = {4, 7, 10};
+	uint8_t uid[10], uidLen, added, i;
+
+	for (added = 0; added < count; added++)
+	{
+		uidLen = sizes[sim_random(seed) % 3];
+		for (i = 0; i < uidLen; i++)
+			uid[i] = sim_random(seed);
+		// 0x88 is the cascade tag, ISO14443-3 rules it out where it would
+		// start a cascade level
+		if (uid[0] == 0x88)
+			uid[0] = 0x04;
+		if (uidLen == 7 && uid[3] == 0x88)
+			uid[3] = 0x08;
+		if (rc522_sim_add_tag(sim, sim_random(seed) % (SIM_TAG_NTAG216 + 1), uid, uidLen) == NULL)
+			break;
+	}
+	return added;
+}
+
+void rc522_sim_transport(rc522_sim *sim, rc522_transport *t)
+{
+	t->ctx = sim;
+	t->transfer = sim_transfer;
+	t->transfer_segments = NULL;
+	t->delay_us = sim_delay_us;
+	t->wait_irq = sim_wait_irq;
+}
@@ -0,0 +1,107 @@
+/*
+ * rc522_sim.h
+ *
+ *  Software model of an RC522 and the ISO14443A tags in its field. It plugs
+ *  in as an rc522_transport, so the unmodified driver can be run, profiled
+ *  and regression tested without a Raspberry Pi.
+ *
+ *  Time is virtual: SPI frames, delays and RF exchanges advance now_ns by
+ *  their nominal duration instead of sleeping.
+ */
+
+#ifndef RC522_SIM_H_
+#define RC522_SIM_H_
+
+#include <stdint.h>
+#include "rc522.h"
+
+#define SIM_MAX_TAGS          16
+#define SIM_TAG_MEMORY        4096
+#define SIM_FRAME_MAX         1024
+
+// Tag types, these determine ATQA, SAK and the memory layout
+#define SIM_TAG_CLASSIC_1K    0
+#define SIM_TAG_CLASSIC_4K    1
+#define SIM_TAG_ULTRALIGHT    2
+#define SIM_TAG_NTAG213       3
+#define SIM_TAG_NTAG215       4
+#define SIM_TAG_NTAG216       5
+
+typedef struct rc522_sim_tag
+{
+	uint8_t type;
+	uint8_t uid[10];
+	uint8_t uidLen;
+	uint8_t atqa[2];
+	uint8_t sak;
+	uint8_t present;
+	uint16_t memorySize;
+	uint8_t memory[SIM_TAG_MEMORY];
+	// A READ of this block is NAKed, -1 for none
+	int16_t nakBlock;
+
+	// ISO14443-3 state, owned by the simulator
+	uint8_t state;
+	uint8_t halted;
+	uint8_t level;
+	int16_t authSector;
+	int16_t writeBlock;
+} rc522_sim_tag;
+
+typedef struct rc522_sim_stats
+{
+	uint64_t transfers;
+	uint64_t bytes;
+	uint64_t regReads;
+	uint64_t regWrites;
+	uint64_t frames;
+	uint64_t timeouts;
+	uint64_t collisions;
+	uint64_t irqWaits;
+} rc522_sim_stats;
+
+typedef struct rc522_sim
+{
+	uint8_t reg[64];
+	uint8_t fifo[DEF_FIFO_LENGTH];
+	uint8_t fifoLen;
+
+	uint64_t now_ns;
+	uint32_t spiHz;
+	uint32_t transferOverheadNs;
+
+	// Outcome of the running command, applied once now_ns reaches doneAt
+	uint8_t pending;
+	uint64_t doneAt;
+	uint8_t doneComIrq;
+	uint8_t doneDivIrq;
+	uint8_t doneError;
+	uint8_t doneColl;
+	uint8_t doneIdle;
+	uint8_t doneStatus2;
+	uint16_t doneLen;
+	uint8_t doneLastBits;
+	uint8_t done[SIM_FRAME_MAX];
+	// The answer's bytes enter the FIFO one by one from doneRxStart on
+	uint64_t doneRxStart;
+	uint16_t donePushed;
+
+	rc522_sim_tag tags[SIM_MAX_TAGS];
+	uint8_t tagCount;
+
+	rc522_sim_stats stats;
+} rc522_sim;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    void rc522_sim_init(rc522_sim *sim);
+    rc522_sim_tag *rc522_sim_add_tag(rc522_sim *sim, uint8_t type, const uint8_t *uid, uint8_t uidLen);
+    void rc522_sim_set_present(rc522_sim_tag *tag, uint8_t present);
+    uint8_t rc522_sim_add_random_tags(rc522_sim *sim, uint8_t count, uint32_t *seed);
+    void rc522_sim_transport(rc522_sim *sim, rc522_transport *t);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RC522_SIM_H_ */
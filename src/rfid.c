@@ -11,9 +11,21 @@
 uint8_t buff[MAXRLEN];
 
 
+// Uses WUPA, so tags that were halted after the previous cycle answer again.
 tag_stat find_tag(uint16_t * card_type) {
+	find_tag_start();
+	return find_tag_finish(card_type,PcdComMF522Wait());
+}
+
+// Split version of find_tag, the reader works on the WUPA between the two
+// calls so the host can serve other readers meanwhile.
+void find_tag_start(void) {
+	PcdRequestStart(PICC_REQALL);
+}
+
+tag_stat find_tag_finish(uint16_t * card_type, uint8_t done) {
 	tag_stat tmp;
-	if ((tmp=PcdRequest(PICC_REQIDL,buff))==TAG_OK) {
+	if ((tmp=PcdRequestFinish(buff,done))==TAG_OK) {
 		*card_type=(int)(buff[0]<<8|buff[1]);
 	}
 	return tmp;
@@ -46,6 +58,420 @@ tag_stat select_tag_sn(uint8_t * sn, uint8_t * len){
 	return TAG_OK;
 }
 
+// Completes an inventory whose WUPA was sent by find_tag_start, status is
+// what find_tag_finish returned. Each tag is selected and HALTed, then REQA
+// is repeated until no tag answers, so only tags not seen yet respond.
+// Stores up to max UIDs and returns how many were found.
+uint8_t inventory_tags(tag_stat status, rfid_uid * uids, uint8_t max) {
+	uint8_t count=0, errors=0, retry=0;
+
+	for (;;) {
+		if (status==TAG_NOTAG) {
+			// A failed selection leaves tags READY, the REQA following it
+			// only sends them back to IDLE and must not end the inventory
+			if (!retry) break;
+			retry=0;
+		}else if (status!=TAG_OK && status!=TAG_COLLISION) {
+			errors++; retry=1;
+		}else{
+			// buff still holds the ATQA unless the answers collided
+			uids[count].atqa=status==TAG_OK?buff[0]<<8|buff[1]:0;
+			if (select_tag_sn(uids[count].sn,&uids[count].len)!=TAG_OK) {
+				errors++; retry=1;
+			}else{
+				uids[count].sak=PcdSak();
+				PcdHalt();
+				count++;
+			}
+		}
+		if (count>=max || errors>=INVENTORY_MAX_ERRORS) break;
+		status=PcdRequest(PICC_REQIDL,buff);
+	}
+
+	// HALTed tags only answer WUPA, which would wake them all at once. A
+	// field reset puts them back to IDLE so the next inventory sees them.
+	// Without any the field stays on, an empty one costs just the WUPA.
+	if (count) PcdFieldReset(INVENTORY_FIELD_RESET_US);
+	return count;
+}
+
+// Wakes the tags with WUPA and selects the one with the given UID directly,
+// without anticollision. Other tags fall back to IDLE/HALT.
+tag_stat wake_tag(const uint8_t * sn, uint8_t len) {
+	static const uint8_t cascades[]={PICC_ANTICOLL1,PICC_ANTICOLL2,PICC_ANTICOLL3};
+	uint8_t cln[4], level, levels, pos=0;
+	tag_stat tmp;
+
+	if (len!=4 && len!=7 && len!=10) {return TAG_ERR;}
+	tmp=PcdRequest(PICC_REQALL,buff);
+	if (tmp!=TAG_OK && tmp!=TAG_COLLISION) {return tmp;}
+
+	// PcdRequest left TxLastBits at 7, SELECT is sent in whole bytes
+	WriteRawRC(BitFramingReg,0x00);
+	levels=len==4 ? 1 : len==7 ? 2 : 3;
+	for (level=0;level<levels;level++) {
+		if (level<levels-1) {
+			cln[0]=0x88;
+			memcpy(cln+1,sn+pos,3);
+			pos+=3;
+		}else{
+			memcpy(cln,sn+pos,4);
+		}
+		if (PcdSelect(cascades[level],cln)!=TAG_OK) {return TAG_NOTAG;}
+	}
+	return TAG_OK;
+}
+
+// HALTs the selected tag and leaves the Crypto1 session, if any
+void release_tag(void) {
+	PcdHalt();
+	WriteRawRC(Status2Reg,0x00);
+}
+
+// The sector of a MIFARE Classic block, 1K/4K layout
+uint8_t block_sector(uint8_t block) {
+	return block<128 ? block/4 : 32+(block-128)/16;
+}
+
+uint8_t sector_first_block(uint8_t sector) {
+	return sector<32 ? sector*4 : 128+(sector-32)*16;
+}
+
+uint8_t sector_blocks(uint8_t sector) {
+	return sector<32 ? 4 : 16;
+}
+
+// Number of sectors of a MIFARE Classic by its SAK, 0 for other tags
+static uint8_t classic_sectors(uint8_t sak) {
+	if (sak==0x09) {return 5;}			// Mini
+	if (sak&0x10) {return 40;}			// 4K
+	if (sak&0x08) {return 16;}			// 1K
+	return 0;
+}
+
+// Selects the tag again if a failed authentication or read left it IDLE
+static uint8_t reselect_tag(const uint8_t * sn, uint8_t len, uint8_t * selected) {
+	if (*selected) {return 1;}
+	WriteRawRC(Status2Reg,0x00);
+	if (wake_tag(sn,len)!=TAG_OK) {return 0;}
+	*selected=1;
+	return 1;
+}
+
+// Authenticates a sector with the key cached for it, then with each of the
+// keys in turn. A wrong key drops the tag to IDLE, so it is selected again
+// before the next attempt; *selected tracks its state. The key that worked
+// is remembered in the cache.
+uint8_t auth_sector(const uint8_t * sn, uint8_t len, uint8_t sector, const rfid_keys * keys, uint8_t * selected) {
+	uint8_t block=sector_first_block(sector);
+	// Crypto1 works on the last four UID bytes
+	uint8_t * snr=(uint8_t *)sn+len-4;
+	keycache_entry * cached=NULL;
+	uint8_t cachedType=0, cachedKey[6];
+	uint16_t i;
+
+	if (keys->cache) {cached=keycache_find(keys->cache,sn,len,sector);}
+	if (cached) {
+		if (!reselect_tag(sn,len,selected)) {return BLOCK_NOTAG;}
+		if (PcdAuthState(cached->keyType,block,cached->key,snr)==TAG_OK) {
+			keys->cache->hits++;
+			return BLOCK_OK;
+		}
+		*selected=0;
+		cachedType=cached->keyType;
+		memcpy(cachedKey,cached->key,6);
+		keycache_remove(keys->cache,cached);
+	}
+	if (keys->cache) {keys->cache->misses++;}
+
+	for (i=0;i<keys->count;i++) {
+		const rfid_key * k=&keys->keys[i];
+		if (cached && k->type==cachedType && memcmp(k->key,cachedKey,6)==0) {continue;}
+		if (!reselect_tag(sn,len,selected)) {return BLOCK_NOTAG;}
+		if (PcdAuthState(k->type,block,(uint8_t *)k->key,snr)==TAG_OK) {
+			if (keys->cache) {keycache_put(keys->cache,sn,len,sector,k->type,k->key);}
+			return BLOCK_OK;
+		}
+		*selected=0;
+	}
+	return BLOCK_AUTH;
+}
+
+// Ends a session, HALTing the tag if it's still selected
+static void end_session(uint8_t selected) {
+	if (selected) {release_tag();}
+	else {WriteRawRC(Status2Reg,0x00);}
+}
+
+// Reads a whole MIFARE Classic into out (up to CLASSIC_MAX_BYTES), every
+// sector in a single Crypto1 session. A sector that fails is zeroed, its
+// BLOCK_* code stored in sectorStatus and the dump goes on with the next
+// one. Returns BLOCK_NOTAG or BLOCK_TYPE if nothing could be read.
+uint8_t dump_tag(const uint8_t * sn, uint8_t len, const rfid_keys * keys,
+		uint8_t * out, uint8_t * sectors, uint8_t * sectorStatus) {
+	uint8_t sector, count, selected=1;
+	uint16_t block, first;
+
+	*sectors=0;
+	if (wake_tag(sn,len)!=TAG_OK) {return BLOCK_NOTAG;}
+	*sectors=classic_sectors(PcdSak());
+	if (*sectors==0) {
+		release_tag();
+		return BLOCK_TYPE;
+	}
+
+	for (sector=0;sector<*sectors;sector++) {
+		first=sector_first_block(sector);
+		count=sector_blocks(sector);
+		memset(out+first*16,0,count*16);
+
+		sectorStatus[sector]=auth_sector(sn,len,sector,keys,&selected);
+		if (sectorStatus[sector]==BLOCK_NOTAG) {
+			// The tag left the field
+			for (;sector<*sectors;sector++) {sectorStatus[sector]=BLOCK_NOTAG;}
+			break;
+		}
+		if (sectorStatus[sector]!=BLOCK_OK) {continue;}
+		for (block=first;block<first+count;block++) {
+			if (PcdRead(block,out+block*16)!=TAG_OK) {
+				sectorStatus[sector]=BLOCK_READ;
+				selected=0;
+				// Nor the blocks read before
+				memset(out+first*16,0,count*16);
+				break;
+			}
+		}
+	}
+
+	end_session(selected);
+	return BLOCK_OK;
+}
+
+// Reads count MIFARE Classic blocks from the tag with the given UID into out,
+// authenticating once per sector.
+uint8_t read_tag_blocks(const uint8_t * sn, uint8_t len, uint8_t block, uint8_t count,
+		const rfid_keys * keys, uint8_t * out) {
+	uint8_t status=BLOCK_OK, selected=1;
+	int16_t sector=-1;
+	uint16_t i;
+
+	if (wake_tag(sn,len)!=TAG_OK) {return BLOCK_NOTAG;}
+	for (i=block;i<block+count;i++) {
+		if (block_sector(i)!=sector) {
+			sector=block_sector(i);
+			if ((status=auth_sector(sn,len,sector,keys,&selected))!=BLOCK_OK) {break;}
+		}
+		if (PcdRead(i,out+(i-block)*16)!=TAG_OK) {status=BLOCK_READ; selected=0; break;}
+	}
+	end_session(selected);
+	return status;
+}
+
+// Pages of the tag whose GET_VERSION reports the storage size size, 0 if unknown
+static uint16_t version_pages(uint8_t size) {
+	switch (size) {
+	case 0x0B: return 20;	// Ultralight EV1 MF0UL11
+	case 0x0E: return 41;	// Ultralight EV1 MF0UL21
+	case 0x0F: return 45;	// NTAG213
+	case 0x11: return 135;	// NTAG215
+	case 0x13: return 231;	// NTAG216
+	}
+	return 0;
+}
+
+// Selects the Ultralight/NTAG21x sn and sets *total to its number of pages
+// as told by GET_VERSION, 0 if it doesn't know the command
+static uint8_t open_pages(const uint8_t * sn, uint8_t len, uint16_t * total) {
+	uint8_t version[8];
+	tag_stat tmp;
+
+	if (wake_tag(sn,len)!=TAG_OK) {return BLOCK_NOTAG;}
+	if (PcdSak()!=0x00) {
+		release_tag();
+		return BLOCK_TYPE;
+	}
+	tmp=PcdGetVersion(version);
+	*total=tmp==TAG_OK && version[1]==0x04 ? version_pages(version[6]) : 0;
+	// A tag that doesn't know GET_VERSION went back to IDLE
+	if (tmp!=TAG_OK && wake_tag(sn,len)!=TAG_OK) {return BLOCK_NOTAG;}
+	return BLOCK_OK;
+}
+
+// Reads count pages from page on into out, which needs room for 2 bytes
+// more: by FAST_READ if the tag's size is known, else by READ. After an
+// error the tag is IDLE, no HALT needed.
+static tag_stat read_pages(uint8_t page, uint16_t count, uint16_t total, uint8_t * out) {
+	uint8_t buf[MAXRLEN];
+	uint16_t i, n;
+	tag_stat tmp;
+
+	for (i=page;i<page+count;i+=n) {
+		if (total) {
+			n=page+count-i<FAST_READ_MAX_PAGES ? page+count-i : FAST_READ_MAX_PAGES;
+			tmp=PcdFastRead(i,i+n-1,out+(i-page)*4);
+		}else{
+			n=page+count-i<4 ? page+count-i : 4;
+			tmp=PcdRead(i,buf);
+			memcpy(out+(i-page)*4,buf,n*4);
+		}
+		if (tmp!=TAG_OK) {return tmp;}
+	}
+	return TAG_OK;
+}
+
+// Reads count pages of an Ultralight or NTAG21x from page on into out, which
+// needs room for 2 bytes more. count 0 reads up to the end of the memory.
+// Tags that report their size by GET_VERSION are read by FAST_READ with up
+// to FAST_READ_MAX_PAGES a frame, others by READ with 4 pages a frame and
+// unless count is given taken for an Ultralight of ULTRALIGHT_PAGES.
+uint8_t read_tag_pages(const uint8_t * sn, uint8_t len, uint8_t page, uint16_t count,
+		uint8_t * out, uint16_t * pages) {
+	uint16_t total, size;
+	uint8_t status;
+
+	*pages=0;
+	if ((status=open_pages(sn,len,&total))!=BLOCK_OK) {return status;}
+
+	size=total ? total : ULTRALIGHT_PAGES;
+	if (count==0) {count=size>page ? size-page : 0;}
+	if (count==0 || page+count>PAGES_MAX || (total && page+count>total)) {
+		release_tag();
+		return BLOCK_RANGE;
+	}
+	if (read_pages(page,count,total,out)!=TAG_OK) {return BLOCK_READ;}
+	*pages=count;
+	release_tag();
+	return BLOCK_OK;
+}
+
+// Reads the NDEF message of a Type 2 tag (Ultralight, NTAG21x) into out,
+// which needs room for PAGES_MAX_BYTES+2 bytes. The capability container in
+// page 3 is read along with the first pages of the data area, from then on
+// only what the TLV parser still needs, so reading ends with the message.
+// *start and *length locate the message in out.
+uint8_t read_tag_ndef(const uint8_t * sn, uint8_t len, uint8_t * out, uint16_t * start, uint16_t * length) {
+	ndef_parser parser;
+	uint16_t total, read, needed, count;
+	uint8_t status, * data=out+4;
+
+	if ((status=open_pages(sn,len,&total))!=BLOCK_OK) {return status;}
+	// CC and 3 pages of data in one frame
+	if (read_pages(3,4,total,out)!=TAG_OK) {return BLOCK_READ;}
+	read=12;
+	if (out[0]!=0xE1) {
+		release_tag();
+		return BLOCK_NDEF;
+	}
+
+	// The CC gives the data area size in units of 8 bytes
+	ndef_init(&parser,out[2]*8);
+	if (total && parser.size>(total-4)*4) {parser.size=(total-4)*4;}
+	while ((status=ndef_feed(&parser,data,read))==NDEF_MORE) {
+		needed=ndef_needed(&parser);
+		count=(needed-read+3)/4;
+		if (read+count*4>PAGES_MAX_BYTES-4) {status=NDEF_ERROR; break;}
+		if (read_pages(4+read/4,count,total,data+read)!=TAG_OK) {return BLOCK_READ;}
+		read+=count*4;
+	}
+	release_tag();
+	if (status!=NDEF_DONE) {return BLOCK_NDEF;}
+	*start=4+parser.messageStart;
+	*length=parser.messageLength;
+	return BLOCK_OK;
+}
+
+void image_clear(rfid_image * image) {
+	image->len=0;
+	memset(image->valid,0,sizeof(image->valid));
+}
+
+uint8_t image_holds(const rfid_image * image, const uint8_t * sn, uint8_t len) {
+	return image->len!=0 && image->len==len && memcmp(image->sn,sn,len)==0;
+}
+
+static uint8_t is_trailer(uint8_t block) {
+	uint8_t sector=block_sector(block);
+	return block==sector_first_block(sector)+sector_blocks(sector)-1;
+}
+
+// Records count blocks of the tag sn, an image of another tag is dropped.
+// Trailers are left out, their keys read back as zeros.
+void image_store(rfid_image * image, const uint8_t * sn, uint8_t len, uint8_t block, uint8_t count,
+		const uint8_t * data) {
+	uint16_t i;
+
+	if (!image_holds(image,sn,len)) {
+		image_clear(image);
+		memcpy(image->sn,sn,len);
+		image->len=len;
+	}
+	for (i=block;i<block+count;i++) {
+		if (is_trailer(i)) {continue;}
+		memcpy(image->data+i*16,data+(i-block)*16,16);
+		image->valid[i/8]|=1<<(i%8);
+	}
+}
+
+static const uint8_t * image_block(const rfid_image * image, const uint8_t * sn, uint8_t len, uint8_t block) {
+	if (!image_holds(image,sn,len) || !(image->valid[block/8]&(1<<(block%8)))) {return NULL;}
+	return image->data+block*16;
+}
+
+// Writes count MIFARE Classic blocks from data to the tag with the given UID,
+// authenticating once per sector. Blocks the image shows to hold their
+// contents already are skipped, so are the authentications of sectors with
+// nothing to write. With verify each block is read back in the same session;
+// for a trailer only the access bits are compared. written counts the blocks
+// written, on failure failed is the block that failed.
+uint8_t write_tag_blocks(const uint8_t * sn, uint8_t len, uint8_t block, uint8_t count,
+		const rfid_keys * keys, const uint8_t * data, uint8_t verify,
+		rfid_image * image, uint8_t * written, uint8_t * failed) {
+	uint8_t status=BLOCK_OK, selected=1, awake=0, check[16], from, size;
+	int16_t sector=-1;
+	uint16_t i;
+	const uint8_t * in, * known;
+
+	*written=0;
+	for (i=block;i<block+count;i++) {
+		in=data+(i-block)*16;
+		known=image ? image_block(image,sn,len,i) : NULL;
+		if (known && memcmp(known,in,16)==0) {continue;}
+
+		*failed=i;
+		if (!awake) {
+			if (wake_tag(sn,len)!=TAG_OK) {
+				if (image && image_holds(image,sn,len)) {image_clear(image);}
+				return BLOCK_NOTAG;
+			}
+			awake=1;
+		}
+		if (block_sector(i)!=sector) {
+			sector=block_sector(i);
+			if ((status=auth_sector(sn,len,sector,keys,&selected))!=BLOCK_OK) {break;}
+		}
+
+		// Whatever happens now, the block may have changed
+		if (image && image_holds(image,sn,len)) {image->valid[i/8]&=~(1<<(i%8));}
+		switch (PcdWrite(i,(uint8_t *)in)) {
+		case TAG_OK: break;
+		case TAG_NAK: status=BLOCK_DENIED; break;
+		default: status=BLOCK_WRITE;
+		}
+		if (status!=BLOCK_OK) {selected=0; break;}
+		(*written)++;
+
+		if (verify) {
+			from=is_trailer(i) ? 6 : 0;
+			size=is_trailer(i) ? 4 : 16;
+			if (PcdRead(i,check)!=TAG_OK) {status=BLOCK_READ; selected=0; break;}
+			if (memcmp(check+from,in+from,size)!=0) {status=BLOCK_VERIFY; break;}
+		}
+		if (image) {image_store(image,sn,len,i,1,in);}
+	}
+	if (awake) {end_session(selected);}
+	return status;
+}
+
 tag_stat read_tag_str(uint8_t addr, char * str) {
 	tag_stat tmp;
 	char *p;
@@ -10,14 +10,96 @@
 
 #include <string.h>
 #include "rc522.h"
+#include "keycache.h"
+#include "ndef.h"
 #include <stdint.h>
 #include <stdio.h>
 
+#define INVENTORY_MAX_TAGS 16
+// Failed requests/selections after which an inventory gives up
+#define INVENTORY_MAX_ERRORS 3
+// Field off time that resets the tags (ISO14443-3 t_RESET >= 5.1ms)
+#define INVENTORY_FIELD_RESET_US 5100
+
+// Result of the block level functions
+#define BLOCK_OK 0
+#define BLOCK_NOTAG 1		// no tag with the UID answered
+#define BLOCK_AUTH 2		// authentication with the key failed
+#define BLOCK_READ 3		// the tag didn't answer READ or the CRC was wrong
+#define BLOCK_TYPE 4		// not a MIFARE Classic tag
+#define BLOCK_WRITE 5		// the tag didn't acknowledge WRITE
+#define BLOCK_DENIED 6		// the tag refused WRITE, e.g. by the access conditions
+#define BLOCK_VERIFY 7		// the block read back differs from what was written
+#define BLOCK_RANGE 8		// pages beyond the end of the tag's memory
+#define BLOCK_NDEF 9		// no NDEF message, or a malformed one
+
+// Largest MIFARE Classic (4K) layout
+#define CLASSIC_MAX_SECTORS 40
+#define CLASSIC_MAX_BYTES 4096
+
+// Ultralight/NTAG21x: pages addressable by READ, FAST_READ frame size and
+// the size assumed for tags that don't tell it by GET_VERSION
+#define PAGES_MAX 256
+#define PAGES_MAX_BYTES (PAGES_MAX*4)
+#define FAST_READ_MAX_PAGES 64
+#define ULTRALIGHT_PAGES 16
+
+typedef struct rfid_key {
+	uint8_t type;		// PICC_AUTHENT1A or PICC_AUTHENT1B
+	uint8_t key[6];
+} rfid_key;
+
+// Keys to authenticate with, and the cache remembering which one worked
+typedef struct rfid_keys {
+	const rfid_key * keys;
+	uint16_t count;
+	keycache * cache;	// NULL for none
+} rfid_keys;
+
+// Blocks last read from or written to one tag, lets writes skip blocks that
+// already hold their contents. Only valid while the tag stays in the field.
+typedef struct rfid_image {
+	uint8_t sn[10];
+	uint8_t len;		// 0 if empty
+	uint8_t valid[CLASSIC_MAX_BYTES/16/8];
+	uint8_t data[CLASSIC_MAX_BYTES];
+} rfid_image;
+
+typedef struct rfid_uid {
+	uint8_t sn[10];
+	uint8_t len;
+	uint16_t atqa;		// like find_tag's card type, 0 if the answers collided
+	uint8_t sak;
+} rfid_uid;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
     tag_stat find_tag(uint16_t *);
+    void find_tag_start(void);
+    tag_stat find_tag_finish(uint16_t *, uint8_t done);
     tag_stat select_tag_sn(uint8_t * sn, uint8_t * len);
+    uint8_t inventory_tags(tag_stat status, rfid_uid * uids, uint8_t max);
+    tag_stat wake_tag(const uint8_t * sn, uint8_t len);
+    void release_tag(void);
+    uint8_t block_sector(uint8_t block);
+    uint8_t auth_sector(const uint8_t * sn, uint8_t len, uint8_t sector, const rfid_keys * keys, uint8_t * selected);
+    uint8_t read_tag_blocks(const uint8_t * sn, uint8_t len, uint8_t block, uint8_t count,
+                            const rfid_keys * keys, uint8_t * out);
+    uint8_t sector_first_block(uint8_t sector);
+    uint8_t sector_blocks(uint8_t sector);
+    uint8_t dump_tag(const uint8_t * sn, uint8_t len, const rfid_keys * keys,
+                     uint8_t * out, uint8_t * sectors, uint8_t * sectorStatus);
+    uint8_t write_tag_blocks(const uint8_t * sn, uint8_t len, uint8_t block, uint8_t count,
+                             const rfid_keys * keys, const uint8_t * data, uint8_t verify,
+                             rfid_image * image, uint8_t * written, uint8_t * failed);
+    uint8_t read_tag_pages(const uint8_t * sn, uint8_t len, uint8_t page, uint16_t count,
+                           uint8_t * out, uint16_t * pages);
+    uint8_t read_tag_ndef(const uint8_t * sn, uint8_t len, uint8_t * out, uint16_t * start, uint16_t * length);
+    void image_clear(rfid_image * image);
+    uint8_t image_holds(const rfid_image * image, const uint8_t * sn, uint8_t len);
+    void image_store(rfid_image * image, const uint8_t * sn, uint8_t len, uint8_t block, uint8_t count,
+                     const uint8_t * data);
     tag_stat read_tag_str(uint8_t addr, char * str);
 #ifdef __cplusplus
 }
@@ -0,0 +1,47 @@
+/*
+ * transport.h
+ *
+ *  Bus abstraction below ReadRawRC/WriteRawRC. The driver only ever needs a
+ *  full duplex SPI frame and a delay, so anything that can provide these
+ *  (the bcm2835 library, the simulator in rc522_sim.c) can drive a reader.
+ */
+
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+#include <stdint.h>
+
+typedef struct rc522_transport
+{
+	void *ctx;
+	// Clock len bytes out of buf while chip select is asserted; the bytes
+	// clocked in replace the contents of buf.
+	void (*transfer)(void *ctx, uint8_t *buf, uint32_t len);
+	// Optional: count frames of lens[i] bytes stored back to back in buf,
+	// chip select is released between them. NULL falls back to transfer().
+	void (*transfer_segments)(void *ctx, uint8_t *buf, const uint32_t *lens, uint32_t count);
+	// Wait for at least us microseconds.
+	void (*delay_us)(void *ctx, uint32_t us);
+	// Block until the chip's IRQ pin is asserted or timeout_us passed.
+	// Returns 1 if the pin is asserted. NULL if the IRQ pin isn't wired.
+	uint8_t (*wait_irq)(void *ctx, uint32_t timeout_us);
+} rc522_transport;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    uint8_t transport_spidev_open(rc522_transport *t, const char *path, uint32_t speedHz);
+    uint8_t transport_spidev_irq(rc522_transport *t, uint8_t pin);
+    void transport_spidev_close(rc522_transport *t);
+    int gpio_irq_open(uint8_t pin);
+    uint8_t gpio_irq_wait(int fd, uint32_t timeout_us);
+#ifdef RC522_WITH_BCM2835
+    uint8_t transport_bcm2835_open(rc522_transport *t, uint16_t clockDivider, uint8_t chipSelect, int16_t csPin, int16_t resetPin);
+    uint8_t transport_bcm2835_irq(rc522_transport *t, uint8_t pin);
+    void transport_bcm2835_close(rc522_transport *t);
+#endif
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRANSPORT_H_ */
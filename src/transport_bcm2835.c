@@ -0,0 +1,147 @@
+/*
+ * transport_bcm2835.c
+ *
+ *  rc522_transport on top of the bcm2835 library. Several readers can share
+ *  SPI0, each one on CE0, CE1 or its own GPIO chip select and with its own
+ *  reset pin and clock divider.
+ */
+#include <stdlib.h>
+#include <unistd.h>
+#include "bcm2835.h"
+#include "transport.h"
+
+typedef struct bcm2835_link
+{
+	int irqFd;
+	uint16_t clockDivider;
+	uint8_t chipSelect;
+	int16_t csPin;
+} bcm2835_link;
+
+// bcm2835_init/spi_begin are process wide, the last close ends them
+static int users = 0;
+// Link the SPI block is currently configured for
+static bcm2835_link *current = NULL;
+
+static void bcm2835_select(bcm2835_link *link)
+{
+	if (current == link)
+	{
+		return;
+	}
+	bcm2835_spi_setClockDivider(link->clockDivider);
+	bcm2835_spi_chipSelect(link->csPin >= 0 ? BCM2835_SPI_CS_NONE : link->chipSelect);
+	current = link;
+}
+
+static void bcm2835_transfer(void *ctx, uint8_t *buf, uint32_t len)
+{
+	bcm2835_link *link = (bcm2835_link *)ctx;
+
+	bcm2835_select(link);
+	if (link->csPin >= 0)
+	{
+		bcm2835_gpio_clr(link->csPin);
+	}
+	bcm2835_spi_transfern((char *)buf, len);
+	if (link->csPin >= 0)
+	{
+		bcm2835_gpio_set(link->csPin);
+	}
+}
+
+static void bcm2835_delay_us(void *ctx, uint32_t us)
+{
+	usleep(us);
+}
+
+static uint8_t bcm2835_wait_irq(void *ctx, uint32_t timeout_us)
+{
+	bcm2835_link *link = (bcm2835_link *)ctx;
+	return gpio_irq_wait(link->irqFd, timeout_us);
+}
+
+// chipSelect is 0 or 1 for CE0/CE1, a csPin >= 0 overrides it with a GPIO
+// driven chip select. resetPin < 0 if the reader's NRSTPD isn't wired.
+uint8_t transport_bcm2835_open(rc522_transport *t, uint16_t clockDivider, uint8_t chipSelect, int16_t csPin, int16_t resetPin)
+{
+	bcm2835_link *link;
+
+	if (users == 0)
+	{
+		if (!bcm2835_init())
+		{
+			return 1;
+		}
+		bcm2835_spi_begin();
+		bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST); // The default
+		bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);				 // The default
+	}
+	users++;
+
+	if (csPin >= 0)
+	{
+		bcm2835_gpio_fsel(csPin, BCM2835_GPIO_FSEL_OUTP);
+		bcm2835_gpio_set(csPin);
+	}
+	else
+	{
+		bcm2835_spi_setChipSelectPolarity(chipSelect, LOW); // the default
+	}
+
+	// Reset device
+	if (resetPin >= 0)
+	{
+		bcm2835_gpio_fsel(resetPin, BCM2835_GPIO_FSEL_OUTP);
+		usleep(50000);
+		bcm2835_gpio_set(resetPin);
+	}
+
+	link = (bcm2835_link *)malloc(sizeof(bcm2835_link));
+	link->irqFd = -1;
+	link->clockDivider = clockDivider;
+	link->chipSelect = chipSelect;
+	link->csPin = csPin;
+
+	t->ctx = link;
+	t->transfer = bcm2835_transfer;
+	t->transfer_segments = NULL;
+	t->delay_us = bcm2835_delay_us;
+	t->wait_irq = NULL;
+	return 0;
+}
+
+uint8_t transport_bcm2835_irq(rc522_transport *t, uint8_t pin)
+{
+	bcm2835_link *link = (bcm2835_link *)t->ctx;
+
+	link->irqFd = gpio_irq_open(pin);
+	if (link->irqFd < 0)
+	{
+		return 1;
+	}
+	t->wait_irq = bcm2835_wait_irq;
+	return 0;
+}
+
+void transport_bcm2835_close(rc522_transport *t)
+{
+	bcm2835_link *link = (bcm2835_link *)t->ctx;
+
+	if (link->irqFd >= 0)
+	{
+		close(link->irqFd);
+	}
+	if (current == link)
+	{
+		current = NULL;
+	}
+	free(link);
+	t->ctx = NULL;
+
+	if (--users == 0)
+	{
+		bcm2835_spi_end();
+		bcm2835_close();
+	}
+}
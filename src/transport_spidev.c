@@ -0,0 +1,143 @@
+/*
+ * transport_spidev.c
+ *
+ *  rc522_transport on top of the kernel spidev driver (/dev/spidevB.C).
+ *  Batches go to the kernel as one SPI_IOC_MESSAGE with chip select
+ *  released between the frames, i.e. one syscall per batch.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include "transport.h"
+
+#define SPIDEV_MAX_SEGMENTS   32
+
+typedef struct spidev_link
+{
+	int fd;
+	int irqFd;
+	uint32_t speedHz;
+	// The last transfer failed, only the first of a run is reported
+	uint8_t failed;
+} spidev_link;
+
+static void spidev_transfer_segments(void *ctx, uint8_t *buf, const uint32_t *lens, uint32_t count)
+{
+	spidev_link *link = (spidev_link *)ctx;
+	struct spi_ioc_transfer tr[SPIDEV_MAX_SEGMENTS];
+	uint8_t *start;
+	uint32_t i, n;
+
+	while (count > 0)
+	{
+		n = count > SPIDEV_MAX_SEGMENTS ? SPIDEV_MAX_SEGMENTS : count;
+		start = buf;
+		memset(tr, 0, sizeof(tr[0]) * n);
+		for (i = 0; i < n; i++)
+		{
+			tr[i].tx_buf = (unsigned long)buf;
+			tr[i].rx_buf = (unsigned long)buf;
+			tr[i].len = lens[i];
+			tr[i].speed_hz = link->speedHz;
+			tr[i].bits_per_word = 8;
+			tr[i].cs_change = i + 1 < n;
+			buf += lens[i];
+		}
+		if (ioctl(link->fd, SPI_IOC_MESSAGE(n), tr) < 0)
+		{
+			// Nothing was clocked in, the registers read as 0 and the
+			// driver fails the command instead of parsing the bytes sent
+			if (!link->failed)
+			{
+				printf("SPI transfer failed: %s\n", strerror(errno));
+			}
+			link->failed = 1;
+			memset(start, 0, buf - start);
+		}
+		else
+		{
+			link->failed = 0;
+		}
+		lens += n;
+		count -= n;
+	}
+}
+
+static void spidev_transfer(void *ctx, uint8_t *buf, uint32_t len)
+{
+	spidev_transfer_segments(ctx, buf, &len, 1);
+}
+
+static void spidev_delay_us(void *ctx, uint32_t us)
+{
+	usleep(us);
+}
+
+static uint8_t spidev_wait_irq(void *ctx, uint32_t timeout_us)
+{
+	spidev_link *link = (spidev_link *)ctx;
+	return gpio_irq_wait(link->irqFd, timeout_us);
+}
+
+uint8_t transport_spidev_open(rc522_transport *t, const char *path, uint32_t speedHz)
+{
+	spidev_link *link;
+	uint8_t mode = SPI_MODE_0, bits = 8;
+	int fd;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+	{
+		return 1;
+	}
+	if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0 || ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+		ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speedHz) < 0)
+	{
+		close(fd);
+		return 1;
+	}
+
+	link = (spidev_link *)malloc(sizeof(spidev_link));
+	link->fd = fd;
+	link->irqFd = -1;
+	link->speedHz = speedHz;
+	link->failed = 0;
+
+	t->ctx = link;
+	t->transfer = spidev_transfer;
+	t->transfer_segments = spidev_transfer_segments;
+	t->delay_us = spidev_delay_us;
+	t->wait_irq = NULL;
+	return 0;
+}
+
+uint8_t transport_spidev_irq(rc522_transport *t, uint8_t pin)
+{
+	spidev_link *link = (spidev_link *)t->ctx;
+
+	link->irqFd = gpio_irq_open(pin);
+	if (link->irqFd < 0)
+	{
+		return 1;
+	}
+	t->wait_irq = spidev_wait_irq;
+	return 0;
+}
+
+void transport_spidev_close(rc522_transport *t)
+{
+	spidev_link *link = (spidev_link *)t->ctx;
+
+	if (link->irqFd >= 0)
+	{
+		close(link->irqFd);
+	}
+	close(link->fd);
+	free(link);
+	t->ctx = NULL;
+}
@@ -0,0 +1,56 @@
+// Batched delivery on the simulator: batches are cut at batchSize and held
+// back for up to batchLatency unless they fill up
+const assert = require("assert");
+const rc522 = require("../main.js");
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+const readers = ["01010101", "02020202", "03030303"].map((uid) => ({
+  simulator: { tags: [{ uid }] },
+}));
+
+async function main() {
+  let calls = [];
+  let start = Date.now();
+  rc522({ delay: 10, batchSize: 2, readers }, (events) => calls.push({ at: Date.now() - start, events }));
+  assert.deepStrictEqual(calls[0].events, [
+    { uid: null, reader: 0 },
+    { uid: null, reader: 1 },
+    { uid: null, reader: 2 },
+  ]);
+
+  // Three events queued while JS is busy come in two calls
+  calls = [];
+  const end = Date.now() + 100;
+  while (Date.now() < end);
+  await sleep(100);
+  assert.deepStrictEqual(calls.map((call) => call.events.length), [2, 1]);
+  const events = calls[0].events.concat(calls[1].events);
+  assert.deepStrictEqual(events.map((event) => event.uid).sort(), ["01010101", "02020202", "03030303"]);
+
+  // The first event waits batchLatency for the others
+  calls = [];
+  start = Date.now();
+  rc522.restart({ delay: 10, batchSize: 10, batchLatency: 150, readers });
+  await sleep(400);
+  assert.strictEqual(calls.length, 1);
+  assert.strictEqual(calls[0].events.length, 3);
+  assert.ok(calls[0].at >= 140, "delivered after " + calls[0].at + "ms");
+
+  // A full batch doesn't wait
+  calls = [];
+  start = Date.now();
+  rc522.restart({ delay: 10, batchSize: 3, batchLatency: 2000, readers });
+  await sleep(400);
+  assert.strictEqual(calls.length, 1);
+  assert.strictEqual(calls[0].events.length, 3);
+  rc522.stop();
+}
+
+main().then(
+  () => console.log("All checks passed"),
+  (error) => {
+    console.log(error);
+    process.exit(1);
+  }
+);
@@ -0,0 +1,54 @@
+// The event queue on the simulator: what a full queue does with the
+// changes that don't fit
+const assert = require("assert");
+const rc522 = require("../main.js");
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+// Keeps the JS thread from draining the queue for ms
+function block(ms) {
+  const end = Date.now() + ms;
+  while (Date.now() < end);
+}
+
+const readers = ["01010101", "02020202", "03030303"].map((uid) => ({
+  simulator: { tags: [{ uid }] },
+}));
+
+async function main() {
+  let found = [];
+  rc522({ delay: 10, eventQueueSize: 1, readers }, (uid, reader) => {
+    if (uid) found.push(reader);
+  });
+
+  // coalesce: the changes that don't fit stay with their reader and are
+  // reported once there is room again
+  block(200);
+  await sleep(200);
+  assert.deepStrictEqual(found.sort(), [0, 1, 2]);
+  let stats = rc522.eventStats();
+  assert.strictEqual(stats.delivered, 3);
+  assert.strictEqual(stats.dropped, 0);
+  assert.ok(stats.coalesced > 0);
+  assert.strictEqual(stats.queued, 0);
+
+  // dropOldest: only the newest event is left
+  found = [];
+  rc522.restart({ delay: 10, eventQueueSize: 1, overflow: "dropOldest", readers });
+  block(200);
+  await sleep(200);
+  stats = rc522.eventStats();
+  assert.strictEqual(found.length, 1);
+  assert.strictEqual(stats.delivered, 1);
+  assert.strictEqual(stats.dropped, 2);
+  assert.strictEqual(stats.coalesced, 0);
+  rc522.stop();
+}
+
+main().then(
+  () => console.log("All checks passed"),
+  (error) => {
+    console.log(error);
+    process.exit(1);
+  }
+);
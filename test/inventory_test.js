@@ -0,0 +1,29 @@
+// Inventory mode on the simulator: the tags a job accesses stay in the
+// reported set
+const assert = require("assert");
+const rc522 = require("../main.js");
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+async function main() {
+  const tags = [{ uid: "01020304" }, { uid: "deadbeef" }];
+  rc522({ delay: 10, inventory: true, readers: [{ simulator: { tags } }] }, () => {});
+  const events = rc522.events();
+  const { value } = await events.next();
+  assert.deepStrictEqual(value.changes.entered.sort(), ["01020304", "deadbeef"]);
+
+  // The job leaves deadbeef HALTed, the polls after it still find both
+  await rc522.readBlock("deadbeef", 4);
+  const next = events.next();
+  assert.strictEqual(await Promise.race([next, sleep(200)]), undefined);
+  rc522.stop();
+  assert.strictEqual((await next).done, true);
+}
+
+main().then(
+  () => console.log("All checks passed"),
+  (error) => {
+    console.log(error);
+    process.exit(1);
+  }
+);
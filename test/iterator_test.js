@@ -0,0 +1,52 @@
+// events() on the simulator: a full iterator stops the queue from being
+// drained until it is read again
+const assert = require("assert");
+const rc522 = require("../main.js");
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+const readers = ["01010101", "02020202", "03030303"].map((uid) => ({
+  simulator: { tags: [{ uid }] },
+}));
+
+async function main() {
+  const called = [];
+  const events = rc522.events({ highWaterMark: 1 });
+  rc522({ delay: 10, readers }, (uid, reader) => {
+    if (uid) called.push(reader);
+  });
+
+  // One event fills the iterator, the other two wait in the native queue
+  await sleep(200);
+  let stats = rc522.eventStats();
+  assert.strictEqual(stats.delivered, 1);
+  assert.strictEqual(stats.queued, 2);
+  assert.strictEqual(called.length, 1);
+
+  // Reading resumes the delivery
+  const uids = [];
+  for await (const event of events) {
+    uids.push(event.uid);
+    if (uids.length === 3) break;
+  }
+  assert.deepStrictEqual(uids.sort(), ["01010101", "02020202", "03030303"]);
+  assert.strictEqual(called.length, 3);
+  stats = rc522.eventStats();
+  assert.strictEqual(stats.delivered, 3);
+  assert.strictEqual(stats.queued, 0);
+
+  // The loop was left, the iterator is done and holds nothing back
+  assert.deepStrictEqual(await events.next(), { value: undefined, done: true });
+  rc522.restart();
+  await sleep(200);
+  assert.strictEqual(called.length, 6);
+  rc522.stop();
+}
+
+main().then(
+  () => console.log("All checks passed"),
+  (error) => {
+    console.log(error);
+    process.exit(1);
+  }
+);
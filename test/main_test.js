@@ -0,0 +1,49 @@
+// Runs the module against the simulator: polling, reads, stop and restart
+// with nextTag() pending, and a reader that can't be opened. Exits with 1 on
+// the first failure or if something keeps the process alive afterwards.
+const assert = require("assert");
+const rc522 = require("../main.js");
+
+const classic = { uid: "deadbeef", type: "classic1k" };
+const ntag = { uid: "04112233445566", type: "ntag216" };
+
+const watchdog = setTimeout(() => {
+  console.log("Timed out, the process didn't exit");
+  process.exit(1);
+}, 10000);
+watchdog.unref();
+
+async function main() {
+  rc522({ delay: 10, readers: [{ simulator: { tags: [classic] } }] }, () => {});
+  const event = await rc522.nextTag({ timeout: 2000 });
+  assert.strictEqual(event.uid, "deadbeef");
+  assert.strictEqual(event.tags[0].sak, 0x08);
+  assert.strictEqual((await rc522.readBlock("deadbeef", 4)).length, 16);
+
+  // The tag stays, only the restart ends the wait
+  const waiting = rc522.nextTag();
+  rc522.restart({ delay: 10, readers: [{ simulator: { tags: [ntag] } }] });
+  await assert.rejects(waiting, { code: "STOPPED" });
+  await rc522.nextTag({ timeout: 2000 });
+  assert.strictEqual((await rc522.readPages(ntag.uid)).length, 231 * 4);
+  await assert.rejects(rc522.readPages(ntag.uid, 0, 256), { code: "RANGE" });
+
+  const stopped = rc522.nextTag();
+  rc522.stop();
+  await assert.rejects(stopped, { code: "STOPPED" });
+  await assert.rejects(rc522.readBlock("deadbeef", 4), { code: "NOREADER" });
+
+  // The reader thread gives up, jobs are rejected and the process exits
+  rc522.restart({ readers: [{ spidev: "/dev/nonexistent" }] });
+  await assert.rejects(rc522.readBlock("deadbeef", 4), { code: "NOREADER" });
+  await new Promise((resolve) => setTimeout(resolve, 100));
+  await assert.rejects(rc522.readBlock("deadbeef", 4), { code: "NOREADER" });
+}
+
+main().then(
+  () => console.log("All checks passed"),
+  (error) => {
+    console.log(error);
+    process.exit(1);
+  }
+);
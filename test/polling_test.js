@@ -0,0 +1,45 @@
+// Adaptive polling on the simulator. The polls of an empty reader are
+// counted in the debug output of a child process, as the native side
+// prints them to stdout.
+const assert = require("assert");
+const { spawnSync } = require("child_process");
+
+// Output of a child polling for 500ms that queues a read at 300ms
+function run(options) {
+  const script = `
+    const rc522 = require(${JSON.stringify(require.resolve("../main.js"))});
+    rc522(${JSON.stringify(options)}, () => {});
+    setTimeout(() => rc522.readBlock("deadbeef", 4).catch((error) => console.log("read " + error.code)), 300);
+    setTimeout(() => rc522.stop(), 500);`;
+  const { stdout, status } = spawnSync(process.execPath, ["-e", script], { encoding: "utf8", timeout: 5000 });
+  assert.strictEqual(status, 0);
+  const lines = stdout.split("\n");
+  return {
+    polls: lines.filter((line) => line.startsWith("No tag found")).length,
+    errors: lines.filter((line) => line.startsWith("Unexpected status")).length,
+    read: lines.find((line) => line.startsWith("read ")),
+  };
+}
+
+const empty = { debug: true, delay: 10, readers: [{ simulator: { tags: [] } }] };
+
+// A fixed delay, about 50 polls
+const fixed = run(empty);
+assert.ok(fixed.polls > 25, fixed.polls + " polls");
+assert.strictEqual(fixed.read, "read NOTAG");
+
+// After 20ms without a tag the pause doubles up to 400ms, the read at 300ms
+// brings another 20ms of fast polls: about 12 polls
+let result = run({ ...empty, idleDelay: 400, activeWindow: 20 });
+assert.ok(result.polls < fixed.polls / 2, result.polls + " polls");
+assert.strictEqual(result.read, "read NOTAG");
+
+// Asleep between polls, woken for each poll and for the read
+for (const powerSave of ["antenna", "powerDown"]) {
+  result = run({ ...empty, idleDelay: 400, activeWindow: 20, powerSave });
+  assert.ok(result.polls > 0 && result.polls < fixed.polls / 2, result.polls + " polls");
+  assert.strictEqual(result.errors, 0);
+  assert.strictEqual(result.read, "read NOTAG");
+}
+
+console.log("All checks passed");
@@ -0,0 +1,571 @@
+/*
+ * rc522_test.c
+ *
+ *  Regression tests of the driver and rfid.c on the simulator and of the
+ *  host side NDEF parser and key cache, one function per behaviour. Prints
+ *  every failed check and exits with 1 if there was one.
+ *
+ *  rc522_test
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rfid.h"
+#include "ndef.h"
+#include "keycache.h"
+#include "presence.h"
+#include "rc522_sim.h"
+
+static uint32_t failures = 0;
+
+#define CHECK(cond) check(cond, #cond, __FILE__, __LINE__)
+
+static void check(int ok, const char *what, const char *file, int line)
+{
+	if (!ok)
+	{
+		printf("%s:%d: %s failed\n", file, line, what);
+		failures++;
+	}
+}
+
+static rc522_sim sim;
+static rc522_transport transport;
+static rc522_dev dev;
+
+static void start_sim(void)
+{
+	rc522_sim_init(&sim);
+	rc522_sim_transport(&sim, &transport);
+	memset(&dev, 0, sizeof(dev));
+	dev.transport = &transport;
+	Rc522Select(&dev);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Driver
+/////////////////////////////////////////////////////////////////////
+
+// With the IRQ pin wired a command's end is waited for on the pin, not by
+// polling ComIrqReg, and an empty field still times out quickly
+static void test_irq_wait(void)
+{
+	static const uint8_t uid[4] = {0xde, 0xad, 0xbe, 0xef};
+	static const rfid_key key = {PICC_AUTHENT1A, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}};
+	rfid_keys keys = {&key, 1, NULL};
+	rc522_sim_tag *tag;
+	uint8_t data[16];
+	uint16_t cardType;
+	uint64_t polled, start;
+
+	start_sim();
+	rc522_sim_add_tag(&sim, SIM_TAG_CLASSIC_1K, uid, sizeof(uid));
+	InitRc522();
+	CHECK(read_tag_blocks(uid, sizeof(uid), 4, 1, &keys, data) == BLOCK_OK);
+	CHECK(sim.stats.irqWaits == 0);
+	polled = sim.stats.regReads;
+
+	start_sim();
+	tag = rc522_sim_add_tag(&sim, SIM_TAG_CLASSIC_1K, uid, sizeof(uid));
+	dev.irq = 1;
+	InitRc522();
+	CHECK(sim.reg[DivlEnReg] == 0x80);
+	CHECK(read_tag_blocks(uid, sizeof(uid), 4, 1, &keys, data) == BLOCK_OK);
+	CHECK(sim.stats.irqWaits > 0);
+	CHECK(sim.stats.regReads < polled);
+
+	rc522_sim_set_present(tag, 0);
+	start = sim.now_ns;
+	CHECK(find_tag(&cardType) == TAG_NOTAG);
+	CHECK(sim.now_ns - start < 1000000);
+}
+
+// Bit changes on configuration registers come from the shadow copy, not an
+// SPI read, volatile registers are always read and a soft reset makes the
+// copy stale
+static void test_shadow(void)
+{
+	uint64_t reads;
+
+	start_sim();
+	InitRc522();
+	reads = sim.stats.regReads;
+	ClearBitMask(TxControlReg, 0x03);
+	SetBitMask(ModeReg, 0x80);
+	CHECK(sim.stats.regReads == reads);
+	CHECK((sim.reg[TxControlReg] & 0x03) == 0);
+	CHECK(sim.reg[ModeReg] == 0xbd);
+
+	SetBitMask(FIFOLevelReg, 0x80);
+	CHECK(sim.stats.regReads == reads + 1);
+
+	WriteRawRC(CommandReg, PCD_RESETPHASE);
+	reads = sim.stats.regReads;
+	SetBitMask(TxControlReg, 0x03);
+	CHECK(sim.stats.regReads == reads + 1);
+	CHECK(sim.reg[TxControlReg] == 0x83);
+	ClearBitMask(TxControlReg, 0x03);
+	CHECK(sim.stats.regReads == reads + 1);
+}
+
+// transfer_segments on top of the simulator, counting the calls
+static uint32_t segmentCalls;
+
+static void count_segments(void *ctx, uint8_t *buf, const uint32_t *lens, uint32_t count)
+{
+	uint32_t i;
+
+	segmentCalls++;
+	for (i = 0; i < count; i++)
+	{
+		transport.transfer(ctx, buf, lens[i]);
+		buf += lens[i];
+	}
+}
+
+// Consecutive reads share one SPI frame, a batch goes to the transport in
+// one call, and one with more segments than BATCH_MAX_SEGMENTS is split
+// without losing or reordering an access
+static void test_batch(void)
+{
+	rc522_transport segmented;
+	rc522_batch batch;
+	uint8_t values[20], i, ok;
+	uint64_t transfers;
+
+	start_sim();
+	InitRc522();
+	segmented = transport;
+	segmented.transfer_segments = count_segments;
+	dev.transport = &segmented;
+	segmentCalls = 0;
+
+	transfers = sim.stats.transfers;
+	PcdBatchBegin(&batch);
+	PcdBatchRead(&batch, TModeReg, &values[0]);
+	PcdBatchRead(&batch, TPrescalerReg, &values[1]);
+	PcdBatchRead(&batch, ModeReg, &values[2]);
+	PcdBatchSubmit(&batch);
+	CHECK(segmentCalls == 1);
+	CHECK(sim.stats.transfers - transfers == 1);
+	CHECK(values[0] == PCD_TMODE && values[1] == 0x3e && values[2] == 0x3d);
+
+	// Every access opens a segment, 40 of them
+	segmentCalls = 0;
+	PcdBatchBegin(&batch);
+	for (i = 0; i < 20; i++)
+	{
+		PcdBatchWrite(&batch, TReloadRegL, i);
+		PcdBatchRead(&batch, TReloadRegL, &values[i]);
+	}
+	PcdBatchSubmit(&batch);
+	CHECK(segmentCalls == 3);
+	ok = 1;
+	for (i = 0; i < 20; i++)
+		ok = ok && values[i] == i;
+	CHECK(ok);
+	CHECK(sim.reg[TReloadRegL] == 19);
+}
+
+// The field is off while the antenna is off or the chip powered down, tags
+// answer again once it is back
+static void test_power_save(void)
+{
+	static const uint8_t uid[4] = {0xde, 0xad, 0xbe, 0xef};
+	uint16_t cardType;
+
+	start_sim();
+	rc522_sim_add_tag(&sim, SIM_TAG_CLASSIC_1K, uid, sizeof(uid));
+	InitRc522();
+
+	PcdAntennaOff();
+	CHECK(find_tag(&cardType) == TAG_NOTAG);
+	PcdAntennaOn();
+	CHECK(find_tag(&cardType) == TAG_OK);
+	release_tag();
+
+	PcdPowerDown();
+	CHECK(sim.reg[CommandReg] & 0x10);
+	PcdPowerUp();
+	CHECK(!(sim.reg[CommandReg] & 0x10));
+	CHECK(PcdCheck() == TAG_OK);
+	CHECK(find_tag(&cardType) == TAG_OK);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Polling
+/////////////////////////////////////////////////////////////////////
+
+// Every tag of random populations up to INVENTORY_MAX_TAGS is found
+static void test_inventory(void)
+{
+	static const uint8_t populations[] = {1, 2, 3, 5, 8, 10, 16};
+	rfid_uid uids[INVENTORY_MAX_TAGS];
+	uint32_t seed = 1, trial;
+	uint16_t cardType;
+	uint8_t p, t, i, count, found;
+
+	for (p = 0; p < sizeof(populations); p++)
+	{
+		for (trial = 0; trial < 20; trial++)
+		{
+			start_sim();
+			rc522_sim_add_random_tags(&sim, populations[p], &seed);
+			InitRc522();
+			find_tag_start();
+			count = inventory_tags(find_tag_finish(&cardType, PcdComMF522Wait()), uids, INVENTORY_MAX_TAGS);
+			CHECK(count == populations[p]);
+
+			found = 0;
+			for (t = 0; t < sim.tagCount; t++)
+			{
+				for (i = 0; i < count; i++)
+				{
+					if (uids[i].len == sim.tags[t].uidLen && memcmp(uids[i].sn, sim.tags[t].uid, uids[i].len) == 0)
+					{
+						found++;
+						break;
+					}
+				}
+			}
+			CHECK(found == populations[p]);
+		}
+	}
+}
+
+// An empty field times out quickly, and the timer is long enough again for
+// the authentication and read once a tag shows up
+static void test_probe(void)
+{
+	static const uint8_t uid[4] = {0xde, 0xad, 0xbe, 0xef};
+	static const rfid_key key = {PICC_AUTHENT1A, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}};
+	rfid_keys keys = {&key, 1, NULL};
+	rc522_sim_tag *tag;
+	uint8_t sn[10], len, data[16];
+	uint16_t cardType;
+	uint64_t start;
+
+	start_sim();
+	tag = rc522_sim_add_tag(&sim, SIM_TAG_CLASSIC_1K, uid, sizeof(uid));
+	rc522_sim_set_present(tag, 0);
+	InitRc522();
+
+	start = sim.now_ns;
+	CHECK(find_tag(&cardType) == TAG_NOTAG);
+	CHECK(sim.now_ns - start < 1000000);
+	CHECK(PcdCheck() == TAG_OK);
+
+	rc522_sim_set_present(tag, 1);
+	CHECK(find_tag(&cardType) == TAG_OK);
+	CHECK(cardType == 0x0400);
+	CHECK(select_tag_sn(sn, &len) == TAG_OK);
+	CHECK(len == 4 && memcmp(sn, uid, 4) == 0);
+	release_tag();
+	CHECK(read_tag_blocks(uid, sizeof(uid), 4, 1, &keys, data) == BLOCK_OK);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Presence
+/////////////////////////////////////////////////////////////////////
+
+#define MS 1000000ULL
+
+// presentAfter sightings in a row make a tag present, a single miss before
+// forgets it
+static void test_present_after(void)
+{
+	rfid_uid tag = {{1, 2, 3, 4}, 4, 0x0004, 0x08};
+	presence p;
+
+	presence_init(&p, 3, 1, 0);
+	presence_update(&p, &tag, 1, 0);
+	CHECK(p.count == 1 && p.tags[0].state == PRESENCE_CANDIDATE);
+	presence_update(&p, NULL, 0, 10 * MS);
+	CHECK(p.count == 0);
+
+	presence_update(&p, &tag, 1, 20 * MS);
+	presence_update(&p, &tag, 1, 30 * MS);
+	CHECK(p.tags[0].state == PRESENCE_CANDIDATE);
+	presence_update(&p, &tag, 1, 40 * MS);
+	CHECK(p.tags[0].state == PRESENCE_PRESENT);
+	CHECK(p.tags[0].firstSeen == 20 * MS && p.tags[0].lastSeen == 40 * MS);
+}
+
+// A present tag is absent after absentAfter misses in a row that span
+// absentTime; a sighting in between starts over
+static void test_absent_after(void)
+{
+	rfid_uid tag = {{1, 2, 3, 4}, 4, 0x0004, 0x08};
+	presence p;
+
+	presence_init(&p, 1, 3, 50 * MS);
+	presence_update(&p, &tag, 1, 0);
+	CHECK(p.tags[0].state == PRESENCE_PRESENT);
+	p.tags[0].reported = 1;
+
+	presence_update(&p, NULL, 0, 10 * MS);
+	presence_update(&p, NULL, 0, 20 * MS);
+	presence_update(&p, &tag, 1, 30 * MS);
+	presence_update(&p, NULL, 0, 40 * MS);
+	presence_update(&p, NULL, 0, 50 * MS);
+	CHECK(p.tags[0].state == PRESENCE_PRESENT);
+	// Three misses, but only 30ms since the last sighting
+	presence_update(&p, NULL, 0, 60 * MS);
+	CHECK(p.tags[0].state == PRESENCE_PRESENT);
+	presence_update(&p, NULL, 0, 80 * MS);
+	CHECK(p.tags[0].state == PRESENCE_GONE);
+	CHECK(p.tags[0].lastSeen == 30 * MS);
+
+	// Back before the departure was reported
+	presence_update(&p, &tag, 1, 90 * MS);
+	CHECK(p.tags[0].state == PRESENCE_PRESENT);
+
+	// A tag never reported is just forgotten
+	p.tags[0].reported = 0;
+	presence_update(&p, NULL, 0, 100 * MS);
+	presence_update(&p, NULL, 0, 110 * MS);
+	presence_update(&p, NULL, 0, 200 * MS);
+	CHECK(p.count == 0);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Reading
+/////////////////////////////////////////////////////////////////////
+
+// A sector whose read fails halfway is zeroed, the dump goes on after it
+static void test_dump_failed_read(void)
+{
+	static const uint8_t uid[4] = {0xde, 0xad, 0xbe, 0xef};
+	static const rfid_key key = {PICC_AUTHENT1A, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}};
+	static const uint8_t zeros[64] = {0};
+	static uint8_t out[CLASSIC_MAX_BYTES];
+	rfid_keys keys = {&key, 1, NULL};
+	rc522_sim_tag *tag;
+	uint8_t sectors, status[CLASSIC_MAX_SECTORS];
+
+	start_sim();
+	tag = rc522_sim_add_tag(&sim, SIM_TAG_CLASSIC_1K, uid, sizeof(uid));
+	memset(tag->memory + 4 * 16, 0xaa, 3 * 16);
+	memset(tag->memory + 8 * 16, 0xbb, 3 * 16);
+	tag->nakBlock = 5;
+	InitRc522();
+
+	CHECK(dump_tag(uid, sizeof(uid), &keys, out, &sectors, status) == BLOCK_OK);
+	CHECK(sectors == 16);
+	CHECK(status[0] == BLOCK_OK);
+	CHECK(status[1] == BLOCK_READ);
+	CHECK(memcmp(out + 4 * 16, zeros, 64) == 0);
+	CHECK(status[2] == BLOCK_OK);
+	CHECK(memcmp(out + 8 * 16, tag->memory + 8 * 16, 3 * 16) == 0);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Writing
+/////////////////////////////////////////////////////////////////////
+
+// The image skips blocks that hold the data already, until a write finds
+// the tag gone; verify reads back what was written
+static void test_write_image(void)
+{
+	static const uint8_t uid[4] = {0xde, 0xad, 0xbe, 0xef};
+	static const rfid_key key = {PICC_AUTHENT1A, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}};
+	static rfid_image image;
+	rfid_keys keys = {&key, 1, NULL};
+	rc522_sim_tag *tag;
+	uint8_t data[32], written, failed;
+
+	start_sim();
+	tag = rc522_sim_add_tag(&sim, SIM_TAG_CLASSIC_1K, uid, sizeof(uid));
+	InitRc522();
+	image_clear(&image);
+	memset(data, 0x5a, sizeof(data));
+
+	CHECK(write_tag_blocks(uid, sizeof(uid), 4, 2, &keys, data, 1, &image, &written, &failed) == BLOCK_OK);
+	CHECK(written == 2);
+	CHECK(memcmp(tag->memory + 4 * 16, data, 32) == 0);
+	CHECK(image_holds(&image, uid, sizeof(uid)));
+	CHECK(write_tag_blocks(uid, sizeof(uid), 4, 2, &keys, data, 1, &image, &written, &failed) == BLOCK_OK);
+	CHECK(written == 0);
+
+	data[16] = 0xa5;
+	CHECK(write_tag_blocks(uid, sizeof(uid), 4, 2, &keys, data, 0, &image, &written, &failed) == BLOCK_OK);
+	CHECK(written == 1);
+	CHECK(tag->memory[5 * 16] == 0xa5);
+
+	// With nothing to write the tag isn't even woken. A write that finds
+	// it gone drops the image, so once it is back, changed meanwhile,
+	// every block is written again.
+	rc522_sim_set_present(tag, 0);
+	CHECK(write_tag_blocks(uid, sizeof(uid), 4, 2, &keys, data, 0, &image, &written, &failed) == BLOCK_OK);
+	CHECK(written == 0);
+	data[0] = 0xa5;
+	CHECK(write_tag_blocks(uid, sizeof(uid), 4, 2, &keys, data, 0, &image, &written, &failed) == BLOCK_NOTAG);
+	CHECK(!image_holds(&image, uid, sizeof(uid)));
+	memset(tag->memory + 4 * 16, 0, 32);
+	rc522_sim_set_present(tag, 1);
+	CHECK(write_tag_blocks(uid, sizeof(uid), 4, 2, &keys, data, 1, &image, &written, &failed) == BLOCK_OK);
+	CHECK(written == 2);
+	CHECK(memcmp(tag->memory + 4 * 16, data, 32) == 0);
+}
+
+/////////////////////////////////////////////////////////////////////
+// NDEF
+/////////////////////////////////////////////////////////////////////
+
+// Feeds the parser as read_tag_ndef does, as many bytes as it needs
+static uint8_t parse_tlvs(const uint8_t *area, uint16_t size, ndef_parser *p)
+{
+	uint16_t fed = 0;
+	uint8_t status;
+
+	ndef_init(p, size);
+	while ((status = ndef_feed(p, area, fed)) == NDEF_MORE)
+	{
+		if (ndef_needed(p) <= fed)
+			return 0xFF;
+		fed = ndef_needed(p);
+	}
+	return status;
+}
+
+static void test_ndef_tlvs(void)
+{
+	// NULL, Lock Control, NDEF Message with one URI record, Terminator
+	static const uint8_t area[] = {0x00, 0x01, 0x03, 0xa0, 0x0c, 0x34, 0x03, 0x08,
+								   0xd1, 0x01, 0x04, 'U', 0x01, 'a', 'b', 'c', 0xfe};
+	static const uint8_t long3[] = {0x03, 0xff, 0x00, 0x02, 0xd0, 0x00};
+	static const uint8_t beyond[] = {0x03, 0x20, 0xd0, 0x00};
+	static const uint8_t skipBeyond[] = {0x01, 0x30, 0x00, 0x00};
+	static const uint8_t cutLength[] = {0x03, 0xff, 0x00};
+	static const uint8_t noLength[] = {0x03};
+	static const uint8_t empty[] = {0x00, 0x00, 0xfe, 0x03, 0x02, 0xd0, 0x00};
+	static const uint8_t nulls[] = {0x00, 0x00, 0x00, 0x00};
+	ndef_parser p;
+
+	CHECK(parse_tlvs(area, sizeof(area), &p) == NDEF_DONE);
+	CHECK(p.messageStart == 8 && p.messageLength == 8);
+	CHECK(parse_tlvs(long3, sizeof(long3), &p) == NDEF_DONE);
+	CHECK(p.messageStart == 4 && p.messageLength == 2);
+
+	CHECK(parse_tlvs(beyond, sizeof(beyond), &p) == NDEF_ERROR);
+	CHECK(parse_tlvs(skipBeyond, sizeof(skipBeyond), &p) == NDEF_ERROR);
+	CHECK(parse_tlvs(cutLength, sizeof(cutLength), &p) == NDEF_ERROR);
+	CHECK(parse_tlvs(noLength, sizeof(noLength), &p) == NDEF_ERROR);
+	CHECK(parse_tlvs(empty, sizeof(empty), &p) == NDEF_NONE);
+	CHECK(parse_tlvs(nulls, sizeof(nulls), &p) == NDEF_NONE);
+}
+
+static void test_ndef_records(void)
+{
+	// URI record, then a Text record with an ID
+	static const uint8_t message[] = {0x91, 0x01, 0x02, 'U', 0x01, 'a',
+									  0x59, 0x01, 0x03, 0x02, 'T', 'i', 'd', 0x02, 'e', 'n'};
+	static const uint8_t shortHeader[] = {0xd1, 0x01};
+	static const uint8_t payloadBeyond[] = {0xd1, 0x01, 0x10, 'U', 0x01};
+	static const uint8_t cutLongLength[] = {0xc1, 0x01, 0x00, 0x00};
+	static const uint8_t wrappingLength[] = {0xc1, 0x01, 0xff, 0xff, 0xff, 0xff, 'U'};
+	static const uint8_t idBeyond[] = {0xd9, 0x01, 0x00, 0xff, 'U'};
+	static const uint8_t noIdLength[] = {0xd9, 0x01, 0x00};
+	ndef_record records[NDEF_MAX_RECORDS];
+	uint8_t count;
+
+	CHECK(ndef_records(message, sizeof(message), records, NDEF_MAX_RECORDS, &count) == 0);
+	CHECK(count == 2);
+	CHECK(records[0].typeOffset == 3 && records[0].typeLength == 1);
+	CHECK(records[0].payloadOffset == 4 && records[0].payloadLength == 2);
+	CHECK(records[1].idOffset == 11 && records[1].idLength == 2);
+	CHECK(records[1].payloadOffset == 13 && records[1].payloadLength == 3);
+	CHECK(ndef_records(message, sizeof(message), records, 1, &count) == 1);
+
+	CHECK(ndef_records(shortHeader, sizeof(shortHeader), records, NDEF_MAX_RECORDS, &count) == 1);
+	CHECK(ndef_records(payloadBeyond, sizeof(payloadBeyond), records, NDEF_MAX_RECORDS, &count) == 1);
+	CHECK(ndef_records(cutLongLength, sizeof(cutLongLength), records, NDEF_MAX_RECORDS, &count) == 1);
+	CHECK(ndef_records(wrappingLength, sizeof(wrappingLength), records, NDEF_MAX_RECORDS, &count) == 1);
+	CHECK(ndef_records(idBeyond, sizeof(idBeyond), records, NDEF_MAX_RECORDS, &count) == 1);
+	CHECK(ndef_records(noIdLength, sizeof(noIdLength), records, NDEF_MAX_RECORDS, &count) == 1);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Key cache
+/////////////////////////////////////////////////////////////////////
+
+static void test_keycache(void)
+{
+	static const uint8_t uid4[4] = {1, 2, 3, 4};
+	static const uint8_t uid7[7] = {4, 5, 6, 7, 8, 9, 10};
+	static const uint8_t keyA[6] = {0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5};
+	static const uint8_t keyB[6] = {0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5};
+	keycache saved, loaded;
+	keycache_entry *e;
+	char path[64];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/tmp/rc522_test_%d.keys", (int)getpid());
+	keycache_init(&saved, 8);
+	keycache_put(&saved, uid4, 4, 1, PICC_AUTHENT1A, keyA);
+	keycache_put(&saved, uid7, 7, 2, PICC_AUTHENT1B, keyB);
+	keycache_put(&saved, uid4, 4, 3, PICC_AUTHENT1B, keyB);
+	CHECK(keycache_save(&saved, path) == 0);
+	CHECK(saved.dirty == 0);
+
+	keycache_init(&loaded, 8);
+	CHECK(keycache_load(&loaded, path) == 0);
+	CHECK(loaded.count == 3);
+	e = keycache_find(&loaded, uid4, 4, 1);
+	CHECK(e != NULL && e->keyType == PICC_AUTHENT1A && memcmp(e->key, keyA, 6) == 0);
+	e = keycache_find(&loaded, uid7, 7, 2);
+	CHECK(e != NULL && e->keyType == PICC_AUTHENT1B && memcmp(e->key, keyB, 6) == 0);
+	CHECK(keycache_find(&loaded, uid7, 7, 1) == NULL);
+	keycache_free(&loaded);
+
+	// A smaller cache keeps the most recently used entries
+	keycache_init(&loaded, 2);
+	CHECK(keycache_load(&loaded, path) == 0);
+	CHECK(loaded.count == 2);
+	CHECK(keycache_find(&loaded, uid4, 4, 1) == NULL);
+	CHECK(keycache_find(&loaded, uid4, 4, 3) != NULL);
+	keycache_free(&loaded);
+
+	// Not a cache file
+	f = fopen(path, "wb");
+	CHECK(f != NULL);
+	if (f != NULL)
+	{
+		fputs("garbage", f);
+		fclose(f);
+	}
+	keycache_init(&loaded, 8);
+	CHECK(keycache_load(&loaded, path) != 0);
+	CHECK(loaded.count == 0);
+	keycache_free(&loaded);
+
+	remove(path);
+	CHECK(keycache_load(&saved, path) != 0);
+	keycache_free(&saved);
+}
+
+int main(void)
+{
+	test_irq_wait();
+	test_shadow();
+	test_batch();
+	test_power_save();
+	test_inventory();
+	test_probe();
+	test_present_after();
+	test_absent_after();
+	test_dump_failed_read();
+	test_write_image();
+	test_ndef_tlvs();
+	test_ndef_records();
+	test_keycache();
+
+	if (failures)
+	{
+		printf("%u checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,38 @@
+// Several readers polled by one thread on the simulator: each reports its
+// own tags and runs the jobs addressed to it
+const assert = require("assert");
+const rc522 = require("../main.js");
+
+async function main() {
+  const readers = [
+    { simulator: { tags: [{ uid: "01010101" }] } },
+    { simulator: { tags: [{ uid: "04020202020202", type: "ntag213" }] } },
+    { simulator: { tags: [] } },
+  ];
+  const initial = [];
+  rc522({ delay: 10, readers }, (uid, reader) => initial.push([uid, reader]));
+  assert.deepStrictEqual(initial, [[null, 0], [null, 1], [null, 2]]);
+
+  const [first, second] = await Promise.all([
+    rc522.nextTag({ reader: 0, timeout: 2000 }),
+    rc522.nextTag({ reader: 1, timeout: 2000 }),
+  ]);
+  assert.strictEqual(first.uid, "01010101");
+  assert.strictEqual(second.uid, "04020202020202");
+  await assert.rejects(rc522.nextTag({ reader: 2, timeout: 100 }), { code: "TIMEOUT" });
+
+  assert.strictEqual((await rc522.readBlock("01010101", 4)).length, 16);
+  await assert.rejects(rc522.readBlock("01010101", 4, null, { reader: 1 }), { code: "NOTAG" });
+  assert.strictEqual((await rc522.readPages("04020202020202", 0, 4, { reader: 1 })).length, 16);
+  await assert.rejects(rc522.readPages("04020202020202", 0, 4, { reader: 2 }), { code: "NOTAG" });
+  await assert.rejects(rc522.readBlock("01010101", 4, null, { reader: 3 }), { code: "NOREADER" });
+  rc522.stop();
+}
+
+main().then(
+  () => console.log("All checks passed"),
+  (error) => {
+    console.log(error);
+    process.exit(1);
+  }
+);
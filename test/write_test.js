@@ -0,0 +1,45 @@
+// writeBlock and writeSector on the simulator: blocks known to hold the
+// data already are skipped, as long as their tag doesn't leave, and verified
+// writes read back what they wrote
+const assert = require("assert");
+const rc522 = require("../main.js");
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+async function main() {
+  // Two tags, the polls select only one of them
+  const tags = [{ uid: "01020304" }, { uid: "deadbeef" }];
+  rc522({ delay: 10, readers: [{ simulator: { tags } }] }, () => {});
+  await rc522.nextTag({ timeout: 2000 });
+
+  const data = Buffer.alloc(16, 0x5a);
+  for (const uid of ["01020304", "deadbeef"]) {
+    assert.deepStrictEqual(await rc522.writeBlock(uid, 4, data), { written: 1, skipped: 0 });
+    await sleep(50);
+    assert.deepStrictEqual(await rc522.writeBlock(uid, 4, data), { written: 0, skipped: 1 });
+  }
+
+  // Verified writes, and a sector top-up that only writes what changed
+  const block = Buffer.alloc(16, 0x11);
+  assert.deepStrictEqual(await rc522.writeBlock("deadbeef", 8, block, null, { verify: true }), { written: 1, skipped: 0 });
+  assert.deepStrictEqual(await rc522.readBlock("deadbeef", 8), block);
+  const sector = await rc522.readSector("deadbeef", 2);
+  sector.fill(0x22, 16, 32);
+  assert.deepStrictEqual(
+    await rc522.writeSector("deadbeef", 2, sector.subarray(0, 48), null, { verify: true }),
+    { written: 1, skipped: 2 }
+  );
+  assert.deepStrictEqual(await rc522.readSector("deadbeef", 2), sector);
+
+  assert.throws(() => rc522.writeBlock("deadbeef", 11, block), RangeError);
+  assert.throws(() => rc522.writeBlock("deadbeef", 0, block), RangeError);
+  rc522.stop();
+}
+
+main().then(
+  () => console.log("All checks passed"),
+  (error) => {
+    console.log(error);
+    process.exit(1);
+  }
+);